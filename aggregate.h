@@ -0,0 +1,235 @@
+//
+//  aggregate.h
+//  dol_fatbody_tj
+//
+
+#ifndef aggregate_h
+#define aggregate_h
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "parameters.h"
+#include "statistics.h"
+
+namespace aggregate {
+
+  // false for NaN and infinities. Tests the exponent bits, because
+  // -ffast-math lets the compiler fold std::isfinite to true.
+  inline bool is_finite(double x) {
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return (bits & 0x7ff0000000000000ull) != 0x7ff0000000000000ull;
+  }
+
+  // online mean and variance (Welford 1962)
+  struct welford {
+    size_t n = 0;
+    double mean = 0.0;
+    double m2 = 0.0;
+
+    void add(double x) {
+      n++;
+      double delta = x - mean;
+      mean += delta / n;
+      m2 += delta * (x - mean);
+    }
+
+    double variance() const {
+      return n > 1 ? m2 / (n - 1) : 0.0;
+    }
+
+    double sd() const {return std::sqrt(variance());}
+  };
+
+  // streaming estimate of a single quantile using five markers,
+  // P^2 algorithm (Jain & Chlamtac 1985). Exact for less than five values.
+  class p2_quantile {
+  public:
+    explicit p2_quantile(double p) : p_(p) {
+      dn_ = {0.0, p / 2, p, (1 + p) / 2, 1.0};
+    }
+
+    void add(double x) {
+      if (count_ < 5) {
+        q_[count_++] = x;
+        if (count_ == 5) {
+          std::sort(q_.begin(), q_.end());
+          n_ = {0.0, 1.0, 2.0, 3.0, 4.0};
+          np_ = {0.0, 2 * p_, 4 * p_, 2 + 2 * p_, 4.0};
+        }
+        return;
+      }
+
+      int k;
+      if (x < q_[0]) {
+        q_[0] = x;
+        k = 0;
+      } else if (x < q_[1]) {
+        k = 0;
+      } else if (x < q_[2]) {
+        k = 1;
+      } else if (x < q_[3]) {
+        k = 2;
+      } else if (x <= q_[4]) {
+        k = 3;
+      } else {
+        q_[4] = x;
+        k = 3;
+      }
+
+      for (int i = k + 1; i < 5; ++i) n_[i] += 1.0;
+      for (int i = 0; i < 5; ++i) np_[i] += dn_[i];
+
+      // adjust the heights of the three middle markers
+      for (int i = 1; i < 4; ++i) {
+        double d = np_[i] - n_[i];
+        if ((d >= 1.0 && n_[i + 1] - n_[i] > 1.0) ||
+            (d <= -1.0 && n_[i - 1] - n_[i] < -1.0)) {
+          int s = d >= 0.0 ? 1 : -1;
+          double qp = parabolic(i, s);
+          if (q_[i - 1] < qp && qp < q_[i + 1]) {
+            q_[i] = qp;
+          } else {
+            q_[i] = linear(i, s);
+          }
+          n_[i] += s;
+        }
+      }
+      count_++;
+    }
+
+    double value() const {
+      if (count_ == 0) return std::numeric_limits<double>::quiet_NaN();
+      if (count_ >= 5) return q_[2];
+
+      std::vector<double> v(q_.begin(), q_.begin() + count_);
+      std::sort(v.begin(), v.end());
+      double pos = p_ * (count_ - 1);
+      size_t lo = static_cast<size_t>(pos);
+      size_t hi = std::min(lo + 1, count_ - 1);
+      return v[lo] + (pos - lo) * (v[hi] - v[lo]);
+    }
+
+    double probability() const {return p_;}
+
+  private:
+    double parabolic(int i, int d) const {
+      return q_[i] + d / (n_[i + 1] - n_[i - 1]) *
+               ((n_[i] - n_[i - 1] + d) * (q_[i + 1] - q_[i]) / (n_[i + 1] - n_[i]) +
+                (n_[i + 1] - n_[i] - d) * (q_[i] - q_[i - 1]) / (n_[i] - n_[i - 1]));
+    }
+
+    double linear(int i, int d) const {
+      return q_[i] + d * (q_[i + d] - q_[i]) / (n_[i + d] - n_[i]);
+    }
+
+    double p_;
+    size_t count_ = 0;
+    std::array<double, 5> q_ = {0.0, 0.0, 0.0, 0.0, 0.0};  // marker heights
+    std::array<double, 5> n_ = {0.0, 0.0, 0.0, 0.0, 0.0};  // marker positions
+    std::array<double, 5> np_ = {0.0, 0.0, 0.0, 0.0, 0.0}; // desired positions
+    std::array<double, 5> dn_;
+  };
+
+  // moments and quantiles of one metric across replicates. Non-finite
+  // values (e.g. Duarte without any recorded switches) are not included.
+  struct metric_summary {
+    welford moments;
+    std::vector<p2_quantile> quantiles;
+
+    metric_summary() {
+      for (auto p : quantile_probs()) quantiles.push_back(p2_quantile(p));
+    }
+
+    static std::vector<double> quantile_probs() {
+      return {0.05, 0.25, 0.5, 0.75, 0.95};
+    }
+
+    void add(double x) {
+      if (!is_finite(x)) return;
+      moments.add(x);
+      for (auto& q : quantiles) q.add(x);
+    }
+  };
+
+  struct dol_summary {
+    size_t num_repl = 0;
+    metric_summary gautrais;
+    metric_summary duarte;
+    metric_summary gorelick_tasks;
+    metric_summary gorelick_indiv;
+    metric_summary gorelick_both;
+
+    void add(const stats::dol_metrics& dol) {
+      num_repl++;
+      gautrais.add(dol.gautrais);
+      duarte.add(dol.duarte);
+      gorelick_tasks.add(dol.gorelick_tasks);
+      gorelick_indiv.add(dol.gorelick_indiv);
+      gorelick_both.add(dol.gorelick_both);
+    }
+  };
+
+  // Reduces the DoL metrics of all replicates to one summary per parameter
+  // point, where a point is identified by the values of params_to_record.
+  class sweep_summary {
+  public:
+    explicit sweep_summary(const std::vector<std::string>& param_names) :
+      param_names_(param_names) {}
+
+    void add(const params& p, const stats::dol_metrics& dol) {
+      if (p.param_names_to_record != param_names_) {
+        throw std::runtime_error("all points in a sweep should record the same parameters");
+      }
+      points_[p.params_to_record].add(dol);
+    }
+
+    void write_header(std::ostream& out) const {
+      for (const auto& i : param_names_) out << i << "\t";
+      out << "num_repl";
+      for (auto name : {"gautrais", "duarte", "gorelick_tasks",
+                        "gorelick_indiv", "gorelick_both"}) {
+        std::string n(name);
+        out << "\t" << n << "_n\t" << n << "_mean\t" << n << "_sd";
+        for (auto p : metric_summary::quantile_probs()) {
+          out << "\t" << n << "_q" << static_cast<int>(std::round(p * 100));
+        }
+      }
+      out << "\n";
+    }
+
+    // one row per parameter point
+    void write(std::ostream& out) const {
+      for (const auto& point : points_) {
+        for (auto i : point.first) out << i << "\t";
+        const auto& s = point.second;
+        out << s.num_repl;
+        for (const auto* m : {&s.gautrais, &s.duarte, &s.gorelick_tasks,
+                              &s.gorelick_indiv, &s.gorelick_both}) {
+          out << "\t" << m->moments.n << "\t" << m->moments.mean << "\t" << m->moments.sd();
+          for (const auto& q : m->quantiles) out << "\t" << q.value();
+        }
+        out << "\n";
+      }
+    }
+
+    size_t num_points() const {return points_.size();}
+    const dol_summary& at(const std::vector<ctype_>& point) const {return points_.at(point);}
+
+  private:
+    std::vector<std::string> param_names_;
+    std::map<std::vector<ctype_>, dol_summary> points_;
+  };
+}
+
+#endif /* aggregate_h */
@@ -0,0 +1,140 @@
+//
+//  batch_simulation.h
+//  dol_fatbody_tj
+//
+
+#ifndef batch_simulation_h
+#define batch_simulation_h
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "parameters.h"
+#include "simulation.h"
+#include "trace.h"
+
+// Steps several replicates (lanes) of the same parameter set in lockstep.
+// The next event times of all colonies are mirrored in an [ant][lane]
+// array, so that the next event search is a loop over contiguous lanes that
+// the compiler vectorises; each step processes the next event of every lane
+// that is still running.
+//
+// The lanes are ordinary Simulations, and every event goes through
+// Simulation::update_individual, so that the individual and sharing code is
+// the same as in the other engines. For a given seed, a lane ends up
+// identical to running Simulation::run on it. Lanes use the scan scheduler,
+// and the parallel colony engine and checkpoints are not supported.
+class BatchSimulation {
+public:
+  explicit BatchSimulation(const std::vector< Simulation* >& lanes) :
+    lanes_(lanes),
+    p_(lanes.front()->p),
+    N_(lanes.front()->colony.size()),
+    B_(lanes.size()) {
+
+    for (auto l : lanes_) {
+      if (l->colony.size() != N_ || l->p.scheduler != scheduler_type::scan ||
+          l->p.num_colony_threads > 1) {
+        throw std::runtime_error("batch lanes need equal colonies and the scan scheduler");
+      }
+    }
+
+    next_t_.resize(N_ * B_);
+    for (size_t r = 0; r < B_; ++r) {
+      for (size_t a = 0; a < N_; ++a) refresh(r, a);
+    }
+    min_t_.resize(B_);
+    min_index_.resize(B_);
+  }
+
+  void run() {
+    trace::scope s("BatchSimulation::run");
+    const time_type end_t = static_cast<time_type>(p_.simulation_time);
+    std::vector<char> running(B_);
+    size_t num_running = 0;
+    for (size_t r = 0; r < B_; ++r) {
+      running[r] = lanes_[r]->t < end_t;
+      num_running += running[r];
+    }
+
+    // progress of the batch is published by its first lane
+    progress::slot* slot = lanes_.front()->progress_slot;
+    uint64_t unpublished_events = 0;
+
+    while (num_running > 0) {
+      find_next_events();
+      for (size_t r = 0; r < B_; ++r) {
+        if (!running[r]) continue;
+        auto& sim = *lanes_[r];
+        sim.t = min_t_[r];
+        sim.take_snapshots(sim.t);
+        if (sim.t <= end_t) {
+          const auto a = static_cast<size_t>(min_index_[r]);
+          sim.update_individual(a);
+          refresh(r, a);
+          for (size_t k = 0; k < sim.num_fed(); ++k) {
+            refresh(r, static_cast<size_t>(sim.nurses[k] - sim.colony.data()));
+          }
+          unpublished_events++;
+        }
+        if (sim.t >= end_t) {
+          running[r] = 0;
+          num_running--;
+        }
+      }
+      if (slot && unpublished_events >= progress::publish_every) {
+        publish_progress(*slot, unpublished_events);
+        unpublished_events = 0;
+      }
+    }
+
+    for (auto l : lanes_) l->finish();
+    if (slot) publish_progress(*slot, unpublished_events);
+  }
+
+private:
+  // first individual with the smallest next_t, per lane
+  void find_next_events() {
+    std::copy(next_t_.begin(), next_t_.begin() + B_, min_t_.begin());
+    std::fill(min_index_.begin(), min_index_.end(), 0);
+    time_type* mt = min_t_.data();
+    int32_t* mi = min_index_.data();
+    for (size_t a = 1; a < N_; ++a) {
+      const time_type* nt = &next_t_[a * B_];
+      const int32_t ai = static_cast<int32_t>(a);
+      for (size_t r = 0; r < B_; ++r) {
+        const bool m = nt[r] < mt[r];
+        mt[r] = m ? nt[r] : mt[r];
+        mi[r] = m ? ai : mi[r];
+      }
+    }
+  }
+
+  void refresh(size_t r, size_t a) {
+    next_t_[a * B_ + r] = lanes_[r]->colony[a].get_next_t();
+  }
+
+  // at the time of the slowest lane
+  void publish_progress(progress::slot& slot, uint64_t events) const {
+    size_t bytes = 0;
+    time_type t = lanes_.front()->t;
+    for (auto l : lanes_) {
+      bytes += l->history_bytes();
+      t = std::min(t, l->t);
+    }
+    slot.publish(static_cast<double>(t), events, bytes);
+  }
+
+  std::vector< Simulation* > lanes_;
+  const params& p_;
+  const size_t N_;  // individuals per colony
+  const size_t B_;  // lanes
+
+  std::vector<time_type> next_t_;    // [ant][lane]
+  std::vector<time_type> min_t_;     // [lane]
+  std::vector<int32_t> min_index_;   // [lane]
+};
+
+#endif /* batch_simulation_h */
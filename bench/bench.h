@@ -0,0 +1,90 @@
+//
+//  bench.h
+//  dol_fatbody_tj
+//
+//  Minimal benchmark harness: a case is timed in repetitions of a fixed
+//  number of iterations, after a few warm-up repetitions, and reported as
+//  nanoseconds per iteration.
+//
+
+#ifndef bench_h
+#define bench_h
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+  struct result {
+    std::string name;
+    size_t iterations = 0;   // per repetition
+    size_t repetitions = 0;
+    double mean_ns = 0.0;    // per iteration
+    double sd_ns = 0.0;
+    double min_ns = 0.0;
+    double max_ns = 0.0;
+  };
+
+  // keeps the compiler from removing a computation whose result is unused
+  template <typename T>
+  inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+  }
+
+  // f(iterations) runs one repetition
+  template <typename F>
+  result measure(const std::string& name, size_t iterations, F f,
+                 size_t repetitions = 10, size_t warmup = 2) {
+    for (size_t i = 0; i < warmup; ++i) f(iterations);
+
+    std::vector<double> ns(repetitions);
+    for (auto& i : ns) {
+      auto start = std::chrono::steady_clock::now();
+      f(iterations);
+      auto end = std::chrono::steady_clock::now();
+      i = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    }
+
+    result r;
+    r.name = name;
+    r.iterations = iterations;
+    r.repetitions = repetitions;
+    for (auto i : ns) r.mean_ns += i;
+    r.mean_ns /= repetitions;
+    for (auto i : ns) r.sd_ns += (i - r.mean_ns) * (i - r.mean_ns);
+    r.sd_ns = repetitions > 1 ? std::sqrt(r.sd_ns / (repetitions - 1)) : 0.0;
+    r.min_ns = *std::min_element(ns.begin(), ns.end());
+    r.max_ns = *std::max_element(ns.begin(), ns.end());
+    return r;
+  }
+
+  inline void write_json(std::ostream& out, const std::vector<result>& results) {
+    out << "{\n  \"unit\": \"ns per iteration\",\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+      const auto& r = results[i];
+      out << "    {\"name\": \"" << r.name << "\", "
+          << "\"iterations\": " << r.iterations << ", "
+          << "\"repetitions\": " << r.repetitions << ", "
+          << "\"mean\": " << r.mean_ns << ", "
+          << "\"sd\": " << r.sd_ns << ", "
+          << "\"min\": " << r.min_ns << ", "
+          << "\"max\": " << r.max_ns << "}"
+          << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+  }
+
+  // stream that discards everything, to time formatting without file I/O
+  class null_buffer : public std::streambuf {
+  protected:
+    int overflow(int c) override {return c;}
+    std::streamsize xsputn(const char*, std::streamsize n) override {return n;}
+  };
+}
+
+#endif /* bench_h */
@@ -0,0 +1,194 @@
+//
+//  microbench.cpp
+//  dol_fatbody_tj
+//
+//  Microbenchmarks of the event loop, the sharing functions, the random
+//  number generators, the statistics and the output writers. Results are
+//  written as JSON, to the file given as first argument or to stdout.
+//  Build and run with: make bench
+//
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../parameters.h"
+#include "../simulation.h"
+#include "../statistics.h"
+#include "bench.h"
+
+namespace {
+
+  params bench_params(size_t colony_size, size_t simulation_time) {
+    params p;
+    p.colony_size = colony_size;
+    p.simulation_time = simulation_time;
+    p.seed = 42;
+    p.data_interval = 0;
+    return p;
+  }
+
+  // finished colony, for the statistics and writers
+  std::unique_ptr<Simulation> run_colony(size_t colony_size, size_t simulation_time,
+                                         int data_interval) {
+    auto p = bench_params(colony_size, simulation_time);
+    p.data_interval = data_interval;
+    auto sim = create_simulation(p);
+    sim->run();
+    return sim;
+  }
+
+  const char* model_name(share_model m) {
+    switch (m) {
+      case share_model::no:        return "no";
+      case share_model::fair:      return "fair";
+      case share_model::dominance: return "dominance";
+      case share_model::fat_body:  return "fat_body";
+      default:                     return "unknown";
+    }
+  }
+
+  void bench_update_colony(std::vector<bench::result>& results) {
+    for (size_t n : {100, 1000}) {
+      for (auto model : {share_model::no, share_model::fair,
+                         share_model::dominance, share_model::fat_body}) {
+        auto p = bench_params(n, 1000000); // long enough to never finish
+        p.model_type = model;
+        auto sim = create_simulation(p);
+        std::string name = std::string("update_colony/") + model_name(model) +
+                           "/colony_size=" + std::to_string(n);
+        results.push_back(bench::measure(name, 20000, [&](size_t iterations) {
+          for (size_t i = 0; i < iterations; ++i) sim->update_colony();
+        }));
+      }
+    }
+  }
+
+  void bench_sharing(std::vector<bench::result>& results) {
+    auto p = bench_params(100, 100);
+    rnd_t rndgen(p.mean_threshold, p.sd_threshold, 1);
+    std::vector<individual> colony(p.colony_size);
+    for (auto& i : colony) i.initialize(p, rndgen, fair_sharing_grouped);
+    std::vector<individual*> nurses;
+    for (size_t i = 1; i < colony.size(); ++i) nurses.push_back(&colony[i]);
+
+    using share_func = std::vector<ctype_> (*)(individual*, std::vector<individual*>, time_type, ctype_, size_t);
+    const std::vector<std::pair<std::string, share_func>> funcs = {
+      {"no_sharing_grouped", no_sharing_grouped},
+      {"fair_sharing_grouped", fair_sharing_grouped},
+      {"dominance_sharing_grouped", dominance_sharing_grouped},
+      {"fatbody_sharing_grouped", fatbody_sharing_grouped}};
+    for (const auto& f : funcs) {
+      results.push_back(bench::measure("sharing/" + f.first, 100000, [&](size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+          auto share = f.second(&colony[0], nurses, 0.f, p.soft_max, p.max_number_interactions);
+          bench::do_not_optimize(share.data());
+        }
+      }));
+    }
+  }
+
+  template <typename RND>
+  void bench_rng(std::vector<bench::result>& results, const std::string& engine) {
+    RND rndgen(5.f, 1.7f, 1);
+    results.push_back(bench::measure("rng/" + engine + "/uniform", 1000000, [&](size_t iterations) {
+      for (size_t i = 0; i < iterations; ++i) bench::do_not_optimize(rndgen.uniform());
+    }));
+    results.push_back(bench::measure("rng/" + engine + "/threshold_normal", 1000000, [&](size_t iterations) {
+      for (size_t i = 0; i < iterations; ++i) bench::do_not_optimize(rndgen.threshold_normal());
+    }));
+    results.push_back(bench::measure("rng/" + engine + "/random_number", 1000000, [&](size_t iterations) {
+      for (size_t i = 0; i < iterations; ++i) bench::do_not_optimize(rndgen.random_number(100));
+    }));
+  }
+
+  void bench_stats(std::vector<bench::result>& results) {
+    for (size_t sim_time : {100, 1000, 10000}) {
+      auto sim = run_colony(100, sim_time, 0);
+      const time_type min_t = 0.1f * sim_time;
+      const time_type max_t = static_cast<time_type>(sim_time);
+      const std::string suffix = "/simulation_time=" + std::to_string(sim_time);
+      const size_t iterations = 1000000 / sim_time;
+
+      results.push_back(bench::measure("stats/gautrais" + suffix, iterations, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+          bench::do_not_optimize(stats::calculate_gautrais(sim->colony, min_t, max_t));
+        }
+      }));
+      results.push_back(bench::measure("stats/duarte" + suffix, iterations, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+          bench::do_not_optimize(stats::calculate_duarte(sim->colony, min_t, max_t));
+        }
+      }));
+      results.push_back(bench::measure("stats/gorelick" + suffix, iterations, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+          auto g = stats::calculate_gorelick(sim->colony, min_t, max_t);
+          bench::do_not_optimize(std::get<0>(g));
+        }
+      }));
+      results.push_back(bench::measure("stats/summarise_ant" + suffix, iterations, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+          for (const auto& ant : sim->colony) {
+            bench::do_not_optimize(stats::summarise_ant(ant, min_t, max_t).mean_fat_body);
+          }
+        }
+      }));
+    }
+  }
+
+  void bench_output(std::vector<bench::result>& results) {
+    bench::null_buffer buffer;
+    std::ostream out(&buffer);
+
+    auto events = run_colony(100, 1000, 0);
+    auto sampled = run_colony(100, 1000, 10);
+    auto p = bench_params(100, 1000);
+    std::vector<size_t> all_ants;
+    for (size_t i = 0; i < p.colony_size; ++i) all_ants.push_back(i);
+    const std::vector<ctype_> param_values = {1.f, 2.f, 3.f};
+    const stats::dol_metrics dol;
+
+    results.push_back(bench::measure("output/write_dol", 100000, [&](size_t n) {
+      for (size_t i = 0; i < n; ++i) output::write_dol(out, param_values, i, dol);
+    }));
+    results.push_back(bench::measure("output/write_ants", 20, [&](size_t n) {
+      for (size_t i = 0; i < n; ++i) output::write_ants(out, events->colony, all_ants, i);
+    }));
+    results.push_back(bench::measure("output/write_ants_summary", 20, [&](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        output::write_ants_summary(out, events->colony, all_ants, i, 100.f, 1000.f);
+      }
+    }));
+    results.push_back(bench::measure("output/write_snapshots", 20, [&](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        output::write_snapshots(out, sampled->snapshots, p.colony_size, i);
+      }
+    }));
+    results.push_back(bench::measure("output/write_dol_sliding_window", 2, [&](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        output::write_dol_sliding_window(out, events->colony, p.window_size,
+                                         10.f, 1000.f, i);
+      }
+    }, 5, 1));
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::vector<bench::result> results;
+  bench_update_colony(results);
+  bench_sharing(results);
+  bench_rng<rnd_t>(results, "mt19937");
+  bench_rng<ant_rnd_t>(results, "splitmix64");
+  bench_stats(results);
+  bench_output(results);
+
+  if (argc > 1) {
+    std::ofstream out(argv[1]);
+    bench::write_json(out, results);
+  } else {
+    bench::write_json(std::cout, results);
+  }
+  return 0;
+}
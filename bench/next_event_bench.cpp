@@ -0,0 +1,144 @@
+//
+//  next_event_bench.cpp
+//  dol_fatbody_tj
+//
+//  Compares ways of finding the next event of a colony: the linear scan
+//  over individuals in Simulation, the dense SIMD argmin, a binary heap
+//  with lazy deletion and the radix heap on integer ticks. Every step pops the earliest event, reschedules it,
+//  and at every third step also reschedules three other individuals, as a
+//  forager return does with the nurses it feeds.
+//
+
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "../parameters.h"
+#include "../simulation.h"
+#include "../next_event.h"
+
+struct workload {
+  std::vector<time_type> dt;
+  std::vector<size_t> fed;
+};
+
+workload make_workload(size_t n, size_t steps) {
+  std::mt19937 rng(42);
+  std::exponential_distribution<time_type> exp_dist(1.f);
+  std::uniform_int_distribution<size_t> pick(0, n - 1);
+  workload w;
+  for (size_t i = 0; i < steps; ++i) w.dt.push_back(exp_dist(rng));
+  for (size_t i = 0; i < steps; ++i) w.fed.push_back(pick(rng));
+  return w;
+}
+
+template <typename F>
+double time_per_step(size_t steps, F step) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < steps; ++i) step(i);
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / steps;
+}
+
+int main() {
+  const size_t steps = 200000;
+  std::cout << "colony_size\tscan_ns\tsimd_ns\theap_ns\tradix_ns\n";
+  for (size_t n : {50, 64, 100, 128, 200, 256, 500, 512, 1000}) {
+    auto w = make_workload(n, steps);
+    params p;
+    p.colony_size = n;
+    p.seed = 1;
+
+    // current scan over individuals
+    Simulation sim(p, fair_sharing_grouped);
+    volatile size_t sink = 0;
+    double scan_ns = time_per_step(steps, [&](size_t i) {
+      auto it = sim.find_next_individual();
+      time_type t = it->get_next_t();
+      it->start_task(t + w.dt[i], it->get_task());
+      if (i % 3 == 0) {
+        for (size_t k = 0; k < 3; ++k) {
+          auto& other = sim.colony[(w.fed[i] + k) % n];
+          other.start_task(t + 0.5f, other.get_task());
+        }
+      }
+      sink = sink + static_cast<size_t>(it - sim.colony.begin());
+    });
+
+    // dense SIMD argmin
+    next_event::simd_selector<time_type> selector;
+    selector.resize(n);
+    for (size_t i = 0; i < n; ++i) selector.set(i, sim.colony[i].get_next_t());
+    double simd_ns = time_per_step(steps, [&](size_t i) {
+      size_t focal = selector.argmin();
+      time_type t = selector.get(focal);
+      selector.set(focal, t + w.dt[i]);
+      if (i % 3 == 0) {
+        for (size_t k = 0; k < 3; ++k) selector.set((w.fed[i] + k) % n, t + 0.5f);
+      }
+      sink = sink + focal;
+    });
+
+    // binary heap, stale entries are skipped when popped
+    using entry = std::pair<time_type, size_t>;
+    std::priority_queue<entry, std::vector<entry>, std::greater<entry>> heap;
+    std::vector<time_type> current(n);
+    for (size_t i = 0; i < n; ++i) {
+      current[i] = sim.colony[i].get_next_t();
+      heap.push({current[i], i});
+    }
+    double heap_ns = time_per_step(steps, [&](size_t i) {
+      while (heap.top().first != current[heap.top().second]) heap.pop();
+      auto top = heap.top();
+      heap.pop();
+      time_type t = top.first;
+      current[top.second] = t + w.dt[i];
+      heap.push({current[top.second], top.second});
+      if (i % 3 == 0) {
+        for (size_t k = 0; k < 3; ++k) {
+          size_t j = (w.fed[i] + k) % n;
+          current[j] = t + 0.5f;
+          heap.push({current[j], j});
+        }
+      }
+      sink = sink + top.second;
+    });
+
+    // radix heap on ticks of 0.001, stale entries are skipped when popped
+    size_t bits = 0;
+    while ((size_t{1} << bits) < n) bits++;
+    auto to_key = [&](time_type t, size_t j) {
+      return (static_cast<uint64_t>(std::ceil(t / 0.001)) << bits) | j;
+    };
+    next_event::radix_heap<size_t> radix;
+    std::vector<uint64_t> keys(n);
+    for (size_t i = 0; i < n; ++i) {
+      keys[i] = to_key(sim.colony[i].get_next_t(), i);
+      radix.push(keys[i], i);
+    }
+    double radix_ns = time_per_step(steps, [&](size_t i) {
+      while (radix.top().first != keys[radix.top().second]) radix.pop();
+      size_t focal = radix.top().second;
+      time_type t = static_cast<time_type>((radix.top().first >> bits) * 0.001);
+      radix.pop();
+      keys[focal] = std::max(to_key(t + w.dt[i], focal), radix.last_key());
+      radix.push(keys[focal], focal);
+      if (i % 3 == 0) {
+        for (size_t k = 0; k < 3; ++k) {
+          size_t j = (w.fed[i] + k) % n;
+          keys[j] = std::max(to_key(t + 0.5f, j), radix.last_key());
+          radix.push(keys[j], j);
+        }
+      }
+      sink = sink + focal;
+    });
+
+    std::cout << n << "\t" << scan_ns << "\t" << simd_ns << "\t" << heap_ns
+              << "\t" << radix_ns << "\n";
+  }
+  return 0;
+}
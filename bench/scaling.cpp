@@ -0,0 +1,198 @@
+//
+//  scaling.cpp
+//  dol_fatbody_tj
+//
+//  Runs one replicate of a model (test.ini by default) on a grid of colony
+//  sizes (10^2 - 10^6) and simulation times (10^3 - 10^6), and reports per
+//  grid point the events per second, the peak resident memory, the bytes
+//  held in histories and the time spent in simulation, statistics and
+//  output. Growth exponents are then fitted on log-log scale along each
+//  axis: at a fixed simulation time, an exponent of 2 in colony size means
+//  that every event costs time linear in the colony.
+//
+//  usage: scaling [config] [max_colony_size] [max_simulation_time] [max_work]
+//  Grid points with colony_size * simulation_time above max_work (default
+//  10^7) are skipped; the full grid takes days with scheduler = scan.
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../parameters.h"
+#include "../simulation.h"
+#include "../statistics.h"
+#include "bench.h"
+
+namespace {
+
+  struct grid_point {
+    size_t colony_size = 0;
+    size_t simulation_time = 0;
+    size_t events = 0;
+    double simulation_s = 0.0;
+    double statistics_s = 0.0;
+    double output_s = 0.0;
+    size_t history_bytes = 0;
+    size_t peak_rss_kb = 0;   // 0 when not available
+  };
+
+  double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // VmHWM from /proc/self/status, in kB
+  size_t peak_rss_kb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+      if (line.compare(0, 6, "VmHWM:") == 0) return std::stoul(line.substr(6));
+    }
+    return 0;
+  }
+
+  // on Linux, restarts the peak at the current resident size, so that
+  // each grid point reports its own peak. Elsewhere peaks accumulate.
+  void reset_peak_rss() {
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    if (clear_refs) clear_refs << "5";
+  }
+
+  grid_point run_point(params p, size_t colony_size, size_t simulation_time) {
+    p.colony_size = colony_size;
+    p.simulation_time = simulation_time;
+    if (p.seed == 0) p.seed = 1;
+    p.num_colony_threads = 1;
+
+    grid_point r;
+    r.colony_size = colony_size;
+    r.simulation_time = simulation_time;
+    reset_peak_rss();
+
+    auto start = std::chrono::steady_clock::now();
+    auto sim = create_simulation(p);
+    // the loop of Simulation::run, counting events; run() then only
+    // finishes the replicate
+    while (sim->t < p.simulation_time) {
+      sim->update_colony();
+      r.events++;
+    }
+    sim->run();
+    r.simulation_s = seconds_since(start);
+
+    const time_type min_t = p.burnin * static_cast<time_type>(p.simulation_time);
+    const time_type max_t = static_cast<time_type>(p.simulation_time);
+    start = std::chrono::steady_clock::now();
+    auto dol = stats::calculate_dol(sim->colony, min_t, max_t);
+    r.statistics_s = seconds_since(start);
+
+    // the output of the analysis stage, formatted but not written
+    bench::null_buffer buffer;
+    std::ostream out(&buffer);
+    start = std::chrono::steady_clock::now();
+    output::write_dol(out, p.params_to_record, 0, dol);
+    if (p.write_ant_output()) {
+      const auto focal_ants = p.get_focal_ants();
+      if (p.ant_output_type == ant_output::summary) {
+        output::write_ants_summary(out, sim->colony, focal_ants, 0, min_t, max_t);
+      } else {
+        output::write_ants(out, sim->colony, focal_ants, 0);
+      }
+    }
+    if (p.data_interval == 0) {
+      output::write_dol_sliding_window(out, sim->colony, p.window_size,
+                                       p.window_step_size, max_t, 0);
+    } else {
+      output::write_snapshots(out, sim->snapshots, sim->colony.size(), 0);
+    }
+    r.output_s = seconds_since(start);
+
+    r.history_bytes = sim->history_bytes();
+    r.peak_rss_kb = peak_rss_kb();
+    return r;
+  }
+
+  // least squares slope of log(y) on log(x), over points with y > 0
+  double fit_exponent(const std::vector<double>& x, const std::vector<double>& y) {
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = 0; i < x.size(); ++i) {
+      if (y[i] <= 0.0) continue;
+      const double lx = std::log(x[i]);
+      const double ly = std::log(y[i]);
+      n++; sx += lx; sy += ly; sxx += lx * lx; sxy += lx * ly;
+    }
+    const double denom = n * sxx - sx * sx;
+    return n < 2 || denom == 0.0 ? NAN : (n * sxy - sx * sy) / denom;
+  }
+
+  // exponents along one axis, for every value of the other axis with at
+  // least two grid points
+  void write_exponents(std::ostream& out, const std::vector<grid_point>& grid,
+                       bool along_colony_size) {
+    std::map<size_t, std::vector<const grid_point*>> lines;
+    for (const auto& g : grid) {
+      lines[along_colony_size ? g.simulation_time : g.colony_size].push_back(&g);
+    }
+    for (const auto& line : lines) {
+      if (line.second.size() < 2) continue;
+      std::vector<double> x, sim_s, stat_s, out_s, hist, rss, events;
+      for (const auto* g : line.second) {
+        x.push_back(static_cast<double>(along_colony_size ? g->colony_size : g->simulation_time));
+        sim_s.push_back(g->simulation_s);
+        stat_s.push_back(g->statistics_s);
+        out_s.push_back(g->output_s);
+        hist.push_back(static_cast<double>(g->history_bytes));
+        rss.push_back(static_cast<double>(g->peak_rss_kb));
+        events.push_back(static_cast<double>(g->events));
+      }
+      out << (along_colony_size ? "colony_size" : "simulation_time") << "\t"
+          << (along_colony_size ? "simulation_time=" : "colony_size=") << line.first << "\t"
+          << fit_exponent(x, events) << "\t"
+          << fit_exponent(x, sim_s) << "\t"
+          << fit_exponent(x, stat_s) << "\t"
+          << fit_exponent(x, out_s) << "\t"
+          << fit_exponent(x, hist) << "\t"
+          << fit_exponent(x, rss) << "\n";
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  try {
+    const std::string file_name = argc > 1 ? argv[1] : "test.ini";
+    const size_t max_colony_size = argc > 2 ? std::stoul(argv[2]) : 10000;
+    const size_t max_simulation_time = argc > 3 ? std::stoul(argv[3]) : 100000;
+    const double max_work = argc > 4 ? std::stod(argv[4]) : 1e7;
+
+    params p(file_name);
+    std::vector<grid_point> grid;
+    std::cout << "colony_size\tsimulation_time\tevents\tevents_per_s\t"
+              << "simulation_s\tstatistics_s\toutput_s\thistory_bytes\tpeak_rss_kb\n";
+    for (size_t n = 100; n <= std::min<size_t>(max_colony_size, 1000000); n *= 10) {
+      for (size_t t = 1000; t <= std::min<size_t>(max_simulation_time, 1000000); t *= 10) {
+        if (static_cast<double>(n) * t > max_work) continue;
+        auto g = run_point(p, n, t);
+        std::cout << g.colony_size << "\t" << g.simulation_time << "\t"
+                  << g.events << "\t" << g.events / g.simulation_s << "\t"
+                  << g.simulation_s << "\t" << g.statistics_s << "\t"
+                  << g.output_s << "\t" << g.history_bytes << "\t"
+                  << g.peak_rss_kb << std::endl;
+        grid.push_back(g);
+      }
+    }
+
+    std::cout << "\nexponents\n"
+              << "axis\tat\tevents\tsimulation\tstatistics\toutput\thistory_bytes\tpeak_rss\n";
+    write_exponents(std::cout, grid, true);
+    write_exponents(std::cout, grid, false);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,250 @@
+//
+//  checkpoint.h
+//  dol_fatbody_tj
+//
+
+#ifndef checkpoint_h
+#define checkpoint_h
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "parameters.h"
+
+namespace checkpoint {
+
+  // file holding the checkpoint of one replicate: <name>_<point>_<repl>.bin,
+  // where the sweep point is given by the values of params_to_record, so
+  // that the points of a sweep do not share checkpoints
+  inline std::string file_name(const params& p, size_t repl) {
+    std::ostringstream name;
+    name << p.checkpoint_file_name;
+    for (auto i : p.params_to_record) name << "_" << i;
+    name << "_" << repl << ".bin";
+    return name.str();
+  }
+
+  // FNV-1a hash of plain values
+  class hasher {
+  public:
+    template <typename T>
+    void add(const T& value) {
+      static_assert(std::is_trivially_copyable<T>::value, "only plain values");
+      const auto* bytes = reinterpret_cast<const unsigned char*>(&value);
+      for (size_t i = 0; i < sizeof(T); ++i) {
+        hash_ = (hash_ ^ bytes[i]) * 1099511628211ull;
+      }
+    }
+
+    uint64_t value() const {return hash_;}
+
+  private:
+    uint64_t hash_ = 14695981039346656037ull;
+  };
+
+  // Hash of every parameter that changes the course of a replicate, apart
+  // from the seed. A checkpoint only continues under the parameters it was
+  // written with.
+  inline uint64_t params_hash(const params& p) {
+    hasher h;
+    h.add(p.simulation_time);
+    h.add(p.data_interval);
+    h.add(p.colony_size);
+    h.add(p.model_type);
+    h.add(p.max_number_interactions);
+    h.add(p.metabolic_cost_nurses);
+    h.add(p.metabolic_cost_foragers);
+    h.add(p.max_fat_body);
+    h.add(p.init_fat_body);
+    h.add(p.mean_threshold);
+    h.add(p.sd_threshold);
+    h.add(p.food_handling_time);
+    h.add(p.resource_amount);
+    h.add(p.foraging_time);
+    h.add(p.burnin);
+    h.add(p.soft_max);
+    h.add(p.per_ant_rng);
+    h.add(p.scheduler);
+    h.add(p.time_resolution);
+    h.add(p.shared_burnin);
+    h.add(p.retain_history);
+    return h.value();
+  }
+
+  // raw binary reads and writes of plain values, in the byte order of the
+  // machine: checkpoints are meant to be resumed on the same kind of node.
+  template <typename T>
+  void write(std::ostream& out, const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value, "only plain values");
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template <typename T>
+  T read(std::istream& in) {
+    static_assert(std::is_trivially_copyable<T>::value, "only plain values");
+    T value;
+    in.read(reinterpret_cast<char*>(&value), sizeof(T));
+    if (!in) throw std::runtime_error("checkpoint is truncated");
+    return value;
+  }
+
+  inline void write_string(std::ostream& out, const std::string& s) {
+    write<uint64_t>(out, s.size());
+    out.write(s.data(), static_cast<std::streamsize>(s.size()));
+  }
+
+  inline std::string read_string(std::istream& in) {
+    std::string s(read<uint64_t>(in), '\0');
+    in.read(&s[0], static_cast<std::streamsize>(s.size()));
+    if (!in) throw std::runtime_error("checkpoint is truncated");
+    return s;
+  }
+
+  // Writes checkpoints from a background thread, so that the simulation only
+  // pays for serialising its state into memory. A checkpoint that is still
+  // waiting when a newer one arrives is dropped. Files are written next to
+  // their final name, synced and renamed, after which the directory is
+  // synced, so a crash or pre-emption during a write leaves the previous
+  // checkpoint intact.
+  class writer {
+  public:
+    explicit writer(const std::string& file_name) :
+      file_name_(file_name), thread_([this]() { work(); }) {}
+
+    writer(const writer&) = delete;
+    writer& operator=(const writer&) = delete;
+
+    ~writer() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      wake_.notify_one();
+      thread_.join();
+    }
+
+    void submit(std::string data) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_ = std::move(data);
+        has_pending_ = true;
+      }
+      wake_.notify_one();
+    }
+
+    // blocks until all submitted checkpoints are on disk, and rethrows
+    // a failed write
+    void wait() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_.wait(lock, [this]() { return !has_pending_ && !busy_; });
+      if (error_) {
+        auto e = error_;
+        error_ = nullptr;
+        std::rethrow_exception(e);
+      }
+    }
+
+    const std::string& file_name() const {return file_name_;}
+
+  private:
+    void work() {
+      while (true) {
+        std::string data;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          wake_.wait(lock, [this]() { return has_pending_ || stop_; });
+          if (!has_pending_) return;
+          data = std::move(pending_);
+          has_pending_ = false;
+          busy_ = true;
+        }
+
+        std::exception_ptr e;
+        try {
+          write_file(data);
+        } catch (...) {
+          e = std::current_exception();
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          busy_ = false;
+          if (e && !error_) error_ = e;
+        }
+        done_.notify_all();
+      }
+    }
+
+    void write_file(const std::string& data) const {
+      const std::string temp_name = file_name_ + ".tmp";
+#ifdef __linux__
+      int fd = ::open(temp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0) throw std::runtime_error("can't open: " + temp_name);
+      size_t written = 0;
+      while (written < data.size()) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        written += static_cast<size_t>(n);
+      }
+      const bool synced = written == data.size() && ::fsync(fd) == 0;
+      if (::close(fd) != 0 || !synced) {
+        throw std::runtime_error("failed writing to: " + temp_name);
+      }
+#else
+      {
+        std::ofstream out(temp_name, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        out.flush();
+        if (!out) throw std::runtime_error("failed writing to: " + temp_name);
+      }
+#endif
+      if (std::rename(temp_name.c_str(), file_name_.c_str()) != 0) {
+        throw std::runtime_error("can't rename checkpoint to: " + file_name_);
+      }
+#ifdef __linux__
+      // makes the rename itself durable
+      const auto slash = file_name_.find_last_of('/');
+      const std::string dir = slash == std::string::npos ? "." :
+                              slash == 0 ? "/" : file_name_.substr(0, slash);
+      int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+      if (dir_fd < 0 || ::fsync(dir_fd) != 0) {
+        if (dir_fd >= 0) ::close(dir_fd);
+        throw std::runtime_error("can't sync directory of: " + file_name_);
+      }
+      ::close(dir_fd);
+#endif
+    }
+
+    std::string file_name_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::string pending_;
+    bool has_pending_ = false;
+    bool busy_ = false;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    std::thread thread_;  // last, starts after the other members exist
+  };
+}
+
+#endif /* checkpoint_h */
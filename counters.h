@@ -0,0 +1,100 @@
+//
+//  counters.h
+//  dol_fatbody_tj
+//
+//  Event and phase counters per replicate. They are compiled in with
+//  -DDOL_COUNTERS (make COUNTERS=1); otherwise the counting statements and
+//  the counter members are left out entirely.
+//
+
+#ifndef counters_h
+#define counters_h
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#ifdef DOL_COUNTERS
+#define DOL_COUNT(statement) statement
+#else
+#define DOL_COUNT(statement)
+#endif
+
+namespace counters {
+
+#ifdef DOL_COUNTERS
+  constexpr bool enabled = true;
+#else
+  constexpr bool enabled = false;
+#endif
+
+  struct event_counts {
+    uint64_t nurse_ends = 0;
+    uint64_t forage_returns = 0;
+    uint64_t food_handling_ends = 0;
+    uint64_t nurses_at_returns = 0;     // summed over forage returns
+    uint64_t max_nurses_at_return = 0;
+    uint64_t sharing_interactions = 0;  // nurses that received food
+    uint64_t threshold_draws = 0;
+    uint64_t threshold_rejections = 0;  // extra draws of the rejection loop
+    uint64_t history_records = 0;       // including replaced ones
+
+    void add(const event_counts& other) {
+      nurse_ends           += other.nurse_ends;
+      forage_returns       += other.forage_returns;
+      food_handling_ends   += other.food_handling_ends;
+      nurses_at_returns    += other.nurses_at_returns;
+      max_nurses_at_return  = std::max(max_nurses_at_return, other.max_nurses_at_return);
+      sharing_interactions += other.sharing_interactions;
+      threshold_draws      += other.threshold_draws;
+      threshold_rejections += other.threshold_rejections;
+      history_records      += other.history_records;
+    }
+
+    uint64_t events() const {
+      return nurse_ends + forage_returns + food_handling_ends;
+    }
+  };
+
+  // wall time per phase of a replicate, in seconds. A replicate run in a
+  // batch is charged an equal share of the batch.
+  struct phase_times {
+    double simulation = 0.0;
+    double statistics = 0.0;
+    double output = 0.0;
+  };
+
+  // the dol file name with _counters before the extension, so that both
+  // end up in the same directory
+  inline std::string file_name(const std::string& dol_file_name) {
+    const auto dot = dol_file_name.find_last_of('.');
+    const auto slash = dol_file_name.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+      return dol_file_name + "_counters";
+    }
+    return dol_file_name.substr(0, dot) + "_counters" + dol_file_name.substr(dot);
+  }
+
+  inline std::string header() {
+    return "repl\tevents\tnurse_ends\tforage_returns\tfood_handling_ends\t"
+           "mean_nurses_at_return\tmax_nurses_at_return\tsharing_interactions\t"
+           "threshold_draws\tthreshold_rejections\thistory_records\t"
+           "simulation_s\tstatistics_s\toutput_s\n";
+  }
+
+  inline void write(std::ostream& out, size_t repl,
+                    const event_counts& c, const phase_times& times) {
+    const double mean_nurses = c.forage_returns == 0 ? 0.0 :
+      static_cast<double>(c.nurses_at_returns) / c.forage_returns;
+    out << repl << "\t" << c.events() << "\t"
+        << c.nurse_ends << "\t" << c.forage_returns << "\t" << c.food_handling_ends << "\t"
+        << mean_nurses << "\t" << c.max_nurses_at_return << "\t"
+        << c.sharing_interactions << "\t"
+        << c.threshold_draws << "\t" << c.threshold_rejections << "\t"
+        << c.history_records << "\t"
+        << times.simulation << "\t" << times.statistics << "\t" << times.output << "\n";
+  }
+}
+
+#endif /* counters_h */
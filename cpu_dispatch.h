@@ -0,0 +1,101 @@
+//
+//  cpu_dispatch.h
+//  dol_fatbody_tj
+//
+//  Runtime choice of the instruction set of the vector kernels, so that a
+//  single build runs at the best speed on every machine. Kernels are built
+//  in one variant per instruction set with DOL_TARGET, and pick the
+//  variant of the active level. The level is the widest one the CPU
+//  supports, and can be capped with max_isa in the config, e.g. to get
+//  bit-identical statistics on a fleet of mixed machines.
+//
+
+#ifndef cpu_dispatch_h
+#define cpu_dispatch_h
+
+#include <algorithm>
+#include <atomic>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define DOL_DISPATCH
+#define DOL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define DOL_TARGET(isa)
+#endif
+
+// shared body of the variants, compiled for the instruction set of the
+// variant it is inlined into
+#if defined(__GNUC__) || defined(__clang__)
+#define DOL_KERNEL inline __attribute__((always_inline))
+#else
+#define DOL_KERNEL inline
+#endif
+
+namespace cpu {
+
+  // ordered from narrow to wide; generic is what the build targets
+  enum class isa {generic, sse4_2, avx2, avx512};
+
+  inline const char* name(isa level) {
+    static const char* names[] = {"generic", "sse4.2", "avx2", "avx512"};
+    return names[static_cast<int>(level)];
+  }
+
+  // widest level the CPU supports
+  inline isa detect() {
+#ifdef DOL_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return isa::avx512;
+    if (__builtin_cpu_supports("avx2")) return isa::avx2;
+    if (__builtin_cpu_supports("sse4.2")) return isa::sse4_2;
+#endif
+    return isa::generic;
+  }
+
+  inline isa supported() {
+    static const isa level = detect();
+    return level;
+  }
+
+  inline std::atomic<isa>& selected() {
+    static std::atomic<isa> level{supported()};
+    return level;
+  }
+
+  // level the kernels use
+  inline isa active() {
+    return selected().load(std::memory_order_relaxed);
+  }
+
+  // uses at most max_level, or less if the CPU does not support it
+  inline isa select(isa max_level) {
+    const isa level = std::min(max_level, supported());
+    selected().store(level, std::memory_order_relaxed);
+    return level;
+  }
+
+#ifdef DOL_DISPATCH
+  template <typename F> DOL_TARGET("avx512f") auto variant_avx512(F& kernel) {return kernel();}
+  template <typename F> DOL_TARGET("avx2")    auto variant_avx2(F& kernel)   {return kernel();}
+  template <typename F> DOL_TARGET("sse4.2")  auto variant_sse4(F& kernel)   {return kernel();}
+#endif
+
+  // Runs a kernel, given as a lambda, compiled for the active level. The
+  // lambda is inlined into one variant per level, where the compiler
+  // vectorises its loops for that instruction set. Vectorised reductions
+  // add up in a different order per level.
+  template <typename F>
+  auto dispatch(F&& kernel) {
+#ifdef DOL_DISPATCH
+    switch (active()) {
+      case isa::avx512:  return variant_avx512(kernel);
+      case isa::avx2:    return variant_avx2(kernel);
+      case isa::sse4_2:  return variant_sse4(kernel);
+      case isa::generic: break;
+    }
+#endif
+    return kernel();
+  }
+}
+
+#endif /* cpu_dispatch_h */
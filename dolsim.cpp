@@ -0,0 +1,289 @@
+//
+//  dolsim.cpp
+//  dol_fatbody_tj
+//
+//  Implementation of the C API in dolsim.h, built into libdolsim with
+//  make lib. No exception leaves the API, failures are reported through
+//  dol_last_error().
+//
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "dolsim.h"
+#include "cpu_dispatch.h"
+#include "observer.h"
+#include "parameters.h"
+#include "simulation.h"
+#include "statistics.h"
+
+static_assert(sizeof(dol_time_t) == sizeof(time_type) && sizeof(dol_state_t) == sizeof(ctype_),
+              "dolsim.h and the library are built with different precision");
+static_assert(std::is_standard_layout<data_storage>::value &&
+              sizeof(dol_record) == sizeof(data_storage) &&
+              offsetof(dol_record, t) == offsetof(data_storage, t_) &&
+              offsetof(dol_record, fat_body) == offsetof(data_storage, fb_) &&
+              offsetof(dol_record, task) == offsetof(data_storage, current_task_) &&
+              sizeof(int32_t) == sizeof(task),
+              "dol_record does not match data_storage");
+
+struct dol_simulation {
+  std::unique_ptr<Simulation> sim;
+  bool finished = false;  // run() has closed the histories
+};
+
+namespace {
+
+  thread_local std::string last_error;
+
+  // runs f, turning exceptions into DOL_ERROR
+  template <typename F>
+  int guarded(F f) {
+    try {
+      f();
+      return DOL_OK;
+    } catch (const std::exception& e) {
+      last_error = e.what();
+    } catch (...) {
+      last_error = "unknown exception";
+    }
+    return DOL_ERROR;
+  }
+
+  void check(bool condition, const char* message) {
+    if (!condition) throw std::invalid_argument(message);
+  }
+
+  params to_params(const dol_params& d) {
+    check(d.colony_size > 0, "colony_size should be larger than 0");
+    check(d.model_type >= 0 && d.model_type < static_cast<int32_t>(share_model::max_model),
+          "model_type should be 0, 1, 2 or 3");
+    check(d.scheduler >= 0 && d.scheduler <= static_cast<int32_t>(scheduler_type::radix),
+          "scheduler should be 0, 1 or 2");
+    check(d.time_resolution > 0, "time_resolution should be larger than 0");
+    check(d.retain_history == 0 || d.retain_history == 1, "retain_history should be 0 or 1");
+    check(d.burnin >= 0 && d.burnin <= 1, "burnin should be in [0, 1]");
+
+    params p;
+    p.simulation_time         = static_cast<size_t>(d.simulation_time);
+    p.data_interval           = d.data_interval;
+    p.colony_size             = static_cast<size_t>(d.colony_size);
+    p.model_type              = static_cast<share_model>(d.model_type);
+    p.max_number_interactions = static_cast<size_t>(d.max_number_interactions);
+    p.metabolic_cost_nurses   = static_cast<ctype_>(d.metabolic_cost_nurses);
+    p.metabolic_cost_foragers = static_cast<ctype_>(d.metabolic_cost_foragers);
+    p.max_fat_body            = static_cast<ctype_>(d.max_fat_body);
+    p.init_fat_body           = static_cast<ctype_>(d.init_fat_body);
+    p.mean_threshold          = static_cast<ctype_>(d.mean_threshold);
+    p.sd_threshold            = static_cast<ctype_>(d.sd_threshold);
+    p.food_handling_time      = static_cast<ctype_>(d.food_handling_time);
+    p.resource_amount         = static_cast<ctype_>(d.resource_amount);
+    p.foraging_time           = static_cast<ctype_>(d.foraging_time);
+    p.burnin                  = static_cast<ctype_>(d.burnin);
+    p.soft_max                = static_cast<ctype_>(d.soft_max);
+    p.seed                    = static_cast<size_t>(d.seed);
+    p.per_ant_rng             = d.per_ant_rng != 0;
+    p.num_colony_threads      = static_cast<size_t>(d.num_colony_threads);
+    p.scheduler               = static_cast<scheduler_type>(d.scheduler);
+    p.time_resolution         = d.time_resolution;
+    p.retain_history          = static_cast<history_retention>(d.retain_history);
+    return p;
+  }
+
+  // a simulation that has not finished yet
+  Simulation& open_simulation(dol_simulation* sim) {
+    check(sim != nullptr, "simulation is NULL");
+    check(!sim->finished, "simulation has finished, reset it to start a new replicate");
+    return *sim->sim;
+  }
+
+  const Simulation& get_simulation(const dol_simulation* sim) {
+    check(sim != nullptr, "simulation is NULL");
+    return *sim->sim;
+  }
+
+  const individual& get_ant(const dol_simulation* sim, size_t ant) {
+    const auto& colony = get_simulation(sim).colony;
+    check(ant < colony.size(), "ant index larger than colony size");
+    return colony[ant];
+  }
+}
+
+int dol_api_version(void) {return DOL_API_VERSION;}
+size_t dol_time_size(void) {return sizeof(time_type);}
+size_t dol_state_size(void) {return sizeof(ctype_);}
+const char* dol_last_error(void) {return last_error.c_str();}
+
+int dol_select_isa(int max_level) {
+  max_level = std::max(0, std::min(max_level, static_cast<int>(cpu::isa::avx512)));
+  return static_cast<int>(cpu::select(static_cast<cpu::isa>(max_level)));
+}
+
+void dol_default_params(dol_params* d) {
+  if (!d) return;
+  const params p;
+  d->simulation_time         = p.simulation_time;
+  d->data_interval           = p.data_interval;
+  d->colony_size             = p.colony_size;
+  d->model_type              = static_cast<int32_t>(p.model_type);
+  d->max_number_interactions = p.max_number_interactions;
+  d->metabolic_cost_nurses   = p.metabolic_cost_nurses;
+  d->metabolic_cost_foragers = p.metabolic_cost_foragers;
+  d->max_fat_body            = p.max_fat_body;
+  d->init_fat_body           = p.init_fat_body;
+  d->mean_threshold          = p.mean_threshold;
+  d->sd_threshold            = p.sd_threshold;
+  d->food_handling_time      = p.food_handling_time;
+  d->resource_amount         = p.resource_amount;
+  d->foraging_time           = p.foraging_time;
+  d->burnin                  = p.burnin;
+  d->soft_max                = p.soft_max;
+  d->seed                    = p.seed;
+  d->per_ant_rng             = p.per_ant_rng;
+  d->num_colony_threads      = p.num_colony_threads;
+  d->scheduler               = static_cast<int32_t>(p.scheduler);
+  d->time_resolution         = p.time_resolution;
+  d->retain_history          = static_cast<int32_t>(p.retain_history);
+}
+
+dol_simulation* dol_create(const dol_params* d) {
+  std::unique_ptr<dol_simulation> sim;
+  int status = guarded([&]() {
+    check(d != nullptr, "params are NULL");
+    sim = std::make_unique<dol_simulation>();
+    sim->sim = create_simulation(to_params(*d));
+  });
+  return status == DOL_OK ? sim.release() : nullptr;
+}
+
+void dol_destroy(dol_simulation* sim) {
+  delete sim;
+}
+
+int dol_reset(dol_simulation* sim, uint64_t seed) {
+  return guarded([&]() {
+    check(sim != nullptr, "simulation is NULL");
+    sim->sim->reset(static_cast<size_t>(seed));
+    sim->finished = false;
+  });
+}
+
+int dol_run(dol_simulation* sim) {
+  return guarded([&]() {
+    open_simulation(sim).run();
+    sim->finished = true;
+  });
+}
+
+int dol_step(dol_simulation* sim, uint64_t num_events) {
+  return guarded([&]() {
+    auto& s = open_simulation(sim);
+    const time_type end = static_cast<time_type>(s.p.simulation_time);
+    for (uint64_t i = 0; i < num_events && s.next_event_time() <= end; ++i) {
+      s.update_colony();
+    }
+  });
+}
+
+int dol_run_until(dol_simulation* sim, double t) {
+  return guarded([&]() {
+    open_simulation(sim).run_until(static_cast<time_type>(t));
+  });
+}
+
+int dol_finished(const dol_simulation* sim) {
+  return sim && sim->finished;
+}
+
+double dol_time(const dol_simulation* sim) {
+  return sim ? static_cast<double>(sim->sim->t) : 0.0;
+}
+
+double dol_next_event_time(dol_simulation* sim) {
+  if (!sim) return 0.0;
+  if (sim->finished) return static_cast<double>(sim->sim->p.simulation_time);
+  return static_cast<double>(sim->sim->next_event_time());
+}
+
+int dol_calculate_dol(const dol_simulation* sim, double min_t, double max_t,
+                      dol_metrics* out) {
+  return guarded([&]() {
+    check(out != nullptr, "output is NULL");
+    const auto dol = stats::calculate_dol(get_simulation(sim).colony,
+                                          static_cast<time_type>(min_t),
+                                          static_cast<time_type>(max_t));
+    out->gautrais       = dol.gautrais;
+    out->duarte         = dol.duarte;
+    out->gorelick_tasks = dol.gorelick_tasks;
+    out->gorelick_indiv = dol.gorelick_indiv;
+    out->gorelick_both  = dol.gorelick_both;
+  });
+}
+
+size_t dol_colony_size(const dol_simulation* sim) {
+  return sim ? sim->sim->colony.size() : 0;
+}
+
+int dol_history(const dol_simulation* sim, size_t ant,
+                const dol_record** records, size_t* num_records) {
+  return guarded([&]() {
+    check(records != nullptr && num_records != nullptr, "output is NULL");
+    const auto& data = get_ant(sim, ant).get_data();
+    *records = reinterpret_cast<const dol_record*>(data.data());
+    *num_records = data.size();
+  });
+}
+
+int dol_snapshots(const dol_simulation* sim,
+                  const dol_record** records, size_t* num_records) {
+  return guarded([&]() {
+    check(records != nullptr && num_records != nullptr, "output is NULL");
+    const auto& snapshots = get_simulation(sim).snapshots;
+    *records = reinterpret_cast<const dol_record*>(snapshots.data());
+    *num_records = snapshots.size();
+  });
+}
+
+int dol_num_feedings(const dol_simulation* sim, size_t ant, uint64_t* num_feedings) {
+  return guarded([&]() {
+    check(num_feedings != nullptr, "output is NULL");
+    *num_feedings = get_ant(sim, ant).get_num_feedings();
+  });
+}
+
+int dol_task_counts(const dol_simulation* sim, uint64_t counts[3]) {
+  return guarded([&]() {
+    check(counts != nullptr, "output is NULL");
+    const auto c = colony_observer(get_simulation(sim)).task_counts();
+    for (size_t i = 0; i < c.size(); ++i) counts[i] = c[i];
+  });
+}
+
+int dol_fat_bodies(const dol_simulation* sim, dol_state_t* out, size_t n) {
+  return guarded([&]() {
+    colony_observer colony(get_simulation(sim));
+    check(out != nullptr, "output is NULL");
+    check(n >= colony.size(), "output smaller than colony size");
+    for (size_t i = 0; i < colony.size(); ++i) out[i] = colony.fat_body(i);
+  });
+}
+
+int dol_ant(const dol_simulation* sim, size_t ant, dol_ant_state* out) {
+  return guarded([&]() {
+    check(out != nullptr, "output is NULL");
+    get_ant(sim, ant);  // checks the index
+    const auto a = colony_observer(get_simulation(sim)).ant(ant);
+    out->task         = static_cast<int32_t>(a.current_task);
+    out->fat_body     = a.fat_body;
+    out->dominance    = a.dominance;
+    out->threshold    = a.threshold;
+    out->next_t       = a.next_t;
+    out->num_feedings = a.num_feedings;
+    out->num_records  = a.num_records;
+  });
+}
@@ -0,0 +1,154 @@
+/*
+ *  dolsim.h
+ *  dol_fatbody_tj
+ *
+ *  C API of libdolsim (make lib), to run simulations in-process from
+ *  other languages. A simulation is created from a dol_params struct, run
+ *  to its end or stepped, and read through the DoL metrics and through
+ *  pointers into its histories, without copies.
+ *
+ *  Functions that can fail return DOL_OK or DOL_ERROR (NULL for
+ *  dol_create); dol_last_error() then holds the message for the calling
+ *  thread. Different simulations can be used from different threads.
+ */
+
+#ifndef dolsim_h
+#define dolsim_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DOL_API __attribute__((visibility("default")))
+#else
+#define DOL_API
+#endif
+
+#define DOL_API_VERSION 1
+
+#define DOL_OK 0
+#define DOL_ERROR 1
+
+/* precision of the build, see parameters.h. Define the same
+   DOL_*_PRECISION as the library, or check dol_time_size() and
+   dol_state_size() at runtime. */
+#if defined(DOL_DOUBLE_PRECISION)
+typedef double dol_time_t;
+typedef double dol_state_t;
+#elif defined(DOL_MIXED_PRECISION)
+typedef double dol_time_t;
+typedef float dol_state_t;
+#else
+typedef float dol_time_t;
+typedef float dol_state_t;
+#endif
+
+/* model parameters, as in the config file. dol_default_params() gives the
+   defaults of params. */
+typedef struct dol_params {
+  uint64_t simulation_time;
+  int32_t  data_interval;            /* > 0: colony snapshot every data_interval time units */
+  uint64_t colony_size;
+  int32_t  model_type;               /* 0 no, 1 fair, 2 dominance, 3 fat body sharing */
+  uint64_t max_number_interactions;
+  double   metabolic_cost_nurses;
+  double   metabolic_cost_foragers;
+  double   max_fat_body;
+  double   init_fat_body;
+  double   mean_threshold;
+  double   sd_threshold;
+  double   food_handling_time;
+  double   resource_amount;
+  double   foraging_time;
+  double   burnin;                   /* fraction of simulation_time */
+  double   soft_max;
+  uint64_t seed;                     /* 0: seed from the clock */
+  int32_t  per_ant_rng;
+  uint64_t num_colony_threads;
+  int32_t  scheduler;                /* 0 scan, 1 simd, 2 radix */
+  double   time_resolution;          /* used with scheduler = 2 */
+  int32_t  retain_history;           /* 1: drop records before the burn-in */
+} dol_params;
+
+typedef struct dol_metrics {
+  double gautrais;
+  double duarte;
+  double gorelick_tasks;
+  double gorelick_indiv;
+  double gorelick_both;
+} dol_metrics;
+
+/* one record of a history or a snapshot, same layout as data_storage */
+typedef struct dol_record {
+  dol_time_t  t;
+  dol_state_t fat_body;
+  int32_t     task;                  /* 0 nurse, 1 forage, 2 food handling */
+} dol_record;
+
+/* state of one ant at dol_time() */
+typedef struct dol_ant_state {
+  int32_t     task;
+  dol_state_t fat_body;
+  dol_state_t dominance;
+  dol_state_t threshold;
+  dol_time_t  next_t;                /* time of its next event */
+  uint64_t    num_feedings;
+  uint64_t    num_records;           /* length of its history */
+} dol_ant_state;
+
+typedef struct dol_simulation dol_simulation;
+
+DOL_API int dol_api_version(void);
+DOL_API size_t dol_time_size(void);
+DOL_API size_t dol_state_size(void);
+DOL_API const char* dol_last_error(void);
+
+/* vector kernels use at most this level (0 generic, 1 sse4.2, 2 avx2,
+   3 avx512) for the whole process; returns the level in use */
+DOL_API int dol_select_isa(int max_level);
+
+DOL_API void dol_default_params(dol_params* p);
+
+DOL_API dol_simulation* dol_create(const dol_params* p);
+DOL_API void dol_destroy(dol_simulation* sim);
+
+/* starts a new replicate in the memory of the previous one */
+DOL_API int dol_reset(dol_simulation* sim, uint64_t seed);
+
+/* runs to simulation_time and closes the histories, after which the
+   simulation is finished. Stepping and running until a time leave the
+   histories open; dol_run_until(sim, t) moves dol_time() to t. */
+DOL_API int dol_run(dol_simulation* sim);
+DOL_API int dol_step(dol_simulation* sim, uint64_t num_events);
+DOL_API int dol_run_until(dol_simulation* sim, double t);
+DOL_API int dol_finished(const dol_simulation* sim);
+DOL_API double dol_time(const dol_simulation* sim);
+DOL_API double dol_next_event_time(dol_simulation* sim);
+
+DOL_API int dol_calculate_dol(const dol_simulation* sim, double min_t, double max_t,
+                              dol_metrics* out);
+
+/* Histories and snapshots point into the simulation and stay valid until
+   it is stepped, run, reset or destroyed. */
+DOL_API size_t dol_colony_size(const dol_simulation* sim);
+DOL_API int dol_history(const dol_simulation* sim, size_t ant,
+                        const dol_record** records, size_t* num_records);
+DOL_API int dol_snapshots(const dol_simulation* sim,
+                          const dol_record** records, size_t* num_records);
+DOL_API int dol_num_feedings(const dol_simulation* sim, size_t ant, uint64_t* num_feedings);
+
+/* the colony at dol_time(), fat bodies evaluated at that time. counts
+   has one entry per task, out one per ant. */
+DOL_API int dol_task_counts(const dol_simulation* sim, uint64_t counts[3]);
+DOL_API int dol_fat_bodies(const dol_simulation* sim, dol_state_t* out, size_t n);
+DOL_API int dol_ant(const dol_simulation* sim, size_t ant, dol_ant_state* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* dolsim_h */
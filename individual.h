@@ -11,6 +11,8 @@
 
 #include "parameters.h"
 #include "rand_t.h"
+#include "checkpoint.h"
+#include "counters.h"
 #include <cassert>
 #include <limits>
 
@@ -19,29 +21,36 @@
 enum class task {nurse, forage, food_handling, max_task};
 
 struct data_storage {
-  const ctype_ t_;
+  const time_type t_;
   const ctype_ fb_;
   const task current_task_;
 
-  data_storage(ctype_ t, task ct, ctype_ fb) : t_(t), fb_(fb), current_task_(ct)  {}
+  data_storage(time_type t, task ct, ctype_ fb) : t_(t), fb_(fb), current_task_(ct)  {}
 };
 
 struct individual {
 private:
   ctype_ fat_body;
   ctype_ crop;
-  ctype_ previous_t;
-  ctype_ next_t;
+  time_type previous_t;
+  time_type next_t;
   ctype_ dominance;
   ctype_ threshold;
   ctype_ max_fat_body;
+  time_type burnin_t;          // feedings before burnin_t are not counted
+  size_t num_feedings;         // number of times the individual received food
+  bool drop_burnin_history;    // keep only the last event before burnin_t
 
   std::array<ctype_, static_cast<int>(task::max_task)> metabolic_rate;
   task current_task;
   task previous_task;
   std::vector< data_storage > data;
 
-  std::vector<ctype_> (*share_interaction_grouped)(individual*, std::vector<individual*>, ctype_, size_t);
+  std::vector<ctype_> (*share_interaction_grouped)(individual*, std::vector<individual*>, time_type, ctype_, size_t);
+
+#ifdef DOL_COUNTERS
+  counters::event_counts counts;
+#endif
 
 public:
 
@@ -52,27 +61,39 @@ public:
   individual(const individual&) = delete;
   const individual& operator=(const individual&) = delete;
 
+  template <typename RND>
   void initialize(const params& p,
-                  rnd_t& rndgen,
-                  std::vector<ctype_> (*share_func_grouped)(individual*, std::vector<individual*>, ctype_, size_t)) {
+                  RND& rndgen,
+                  std::vector<ctype_> (*share_func_grouped)(individual*, std::vector<individual*>, time_type, ctype_, size_t)) {
     share_interaction_grouped = share_func_grouped;
 
+    // also used to start a new replicate with the same individual, where
+    // the history keeps its memory
+    data.clear();
+    crop = 0.f;
+    previous_t = 0.f;
+    previous_task = task::nurse;
+    DOL_COUNT(counts = counters::event_counts());
+
     fat_body = p.init_fat_body;
     max_fat_body = p.max_fat_body;
+    burnin_t = p.burnin * static_cast<time_type>(p.simulation_time);
+    num_feedings = 0;
+    drop_burnin_history = p.drop_burnin_history();
 
     metabolic_rate = {p.metabolic_cost_nurses,
                       p.metabolic_cost_foragers,
                       p.metabolic_cost_nurses};
 
     dominance = static_cast<ctype_>(rndgen.uniform());
-    next_t = get_next_t_threshold(ctype_(0.0), rndgen);
+    next_t = get_next_t_threshold(time_type(0.0), rndgen);
     if(next_t < 0.0) {
-      next_t = ctype_(0.0);
+      next_t = time_type(0.0);
     }
 
     start_task(next_t, task::nurse);
 
-    update_data(ctype_(0.0));
+    update_data(time_type(0.0));
   }
 
   individual() {
@@ -84,21 +105,27 @@ public:
     next_t = 0.f;
     dominance = 0.f;
     threshold = 5.f;
+    burnin_t = 0.f;
+    num_feedings = 0;
+    drop_burnin_history = false;
     metabolic_rate = {1.0, 1.0, 1.0}; // bogus values
   }
 
-  void update(ctype_ t,
+  template <typename RND>
+  void update(time_type t,
               const params& p,
-              rnd_t& rndgen,
+              RND& rndgen,
               std::vector< individual* >& nurses) {
 
     set_previous_task(); 
 
     if (previous_task == task::forage) {
       // update forager
+      DOL_COUNT(count_forage_return(nurses.size()));
       update_forager(t, p, nurses, rndgen);
     } else {
       // nurse done nursing, or done handling food
+      DOL_COUNT(previous_task == task::nurse ? counts.nurse_ends++ : counts.food_handling_ends++);
       update_nurse(t);
     }
 
@@ -107,15 +134,17 @@ public:
     update_data(t);
   }
 
-  ctype_ get_next_t_threshold(ctype_ t, rnd_t& rndgen) {
+  template <typename RND>
+  time_type get_next_t_threshold(time_type t, RND& rndgen) {
     // this function is only used by nurses
     threshold = static_cast<ctype_>(rndgen.threshold_normal());
+    DOL_COUNT(counts.threshold_draws++);
     ctype_ dt = metabolic_rate[ static_cast<int>(task::nurse) ] == 0.f ? 1e20f : (fat_body - threshold) / metabolic_rate[ static_cast<int>(task::nurse) ];
 
     return(t + dt);
   }
 
-  void start_task(ctype_ new_t, task new_task) {
+  void start_task(time_type new_t, task new_task) {
     current_task = new_task;
     next_t = new_t;
   }
@@ -124,12 +153,16 @@ public:
     previous_task = current_task;
   }
 
-  void update_fatbody(ctype_ t) {
-    ctype_ dt = t - previous_t;
+  // The fat body falls linearly at the metabolic rate of the current task
+  // and is stored as its value at previous_t. It is only brought forward
+  // when the rate or the value changes: at events of the individual itself
+  // and when it receives food. Everyone else reads get_fat_body_at(t).
+  void update_fatbody(time_type t) {
+    time_type dt = t - previous_t;
     assert(dt >= 0);
     if (dt < 0) return;
     previous_t = t;
-    fat_body -= dt * metabolic_rate[ static_cast<int>(current_task) ];
+    fat_body -= static_cast<ctype_>(dt) * metabolic_rate[ static_cast<int>(current_task) ];
     if (fat_body < 0) fat_body = 0.f; // should not happen!
   }
 
@@ -145,11 +178,12 @@ public:
   }
 
   ctype_ handle_food(ctype_ food, // amount shared by the forager to the nurse
-                     ctype_ t,
+                     time_type t,
                      ctype_ handling_time) {
 
     crop += food;
     food -= food;
+    if (t >= burnin_t) num_feedings++;
 
     current_task = task::food_handling;
     next_t = t + handling_time;
@@ -157,10 +191,11 @@ public:
     return food;
   }
 
-  void decide_new_task(ctype_ t,
-                       rnd_t& rndgen,
+  template <typename RND>
+  void decide_new_task(time_type t,
+                       RND& rndgen,
                        ctype_ foraging_time) {
-    ctype_ new_t = get_next_t_threshold(t, rndgen);
+    time_type new_t = get_next_t_threshold(t, rndgen);
 
     // if new_t is in the future: go nurse
     // otherwise, go foraging
@@ -172,18 +207,19 @@ public:
      }
   }
 
-  void update_data(ctype_ t) {
+  void update_data(time_type t) {
     assert(t >= previous_t);
     previous_t = t;
 
     auto focal_task = current_task;
     if (current_task == task::food_handling) focal_task = task::nurse;
 
-    data.push_back( data_storage(t, focal_task, fat_body));
+    add_record(t, focal_task, fat_body);
   }
 
-  void pick_new_task(ctype_ t,
-                     rnd_t& rndgen,
+  template <typename RND>
+  void pick_new_task(time_type t,
+                     RND& rndgen,
                      const params& p) {
     if (get_previous_task() == task::forage) {
       // individual has returned from foraging
@@ -205,10 +241,11 @@ public:
     }
   }
 
-  void update_forager(ctype_ t,
+  template <typename RND>
+  void update_forager(time_type t,
                       const params& p,
                       std::vector< individual* >& nurses,
-                      rnd_t& rndgen) {
+                      RND& rndgen) {
     update_fatbody(t);
 
     set_crop(p.resource_amount);
@@ -218,34 +255,110 @@ public:
     return;
   }
 
-  void update_nurse(ctype_ t) {
+  void update_nurse(time_type t) {
     update_fatbody(t);
     return;
   }
 
 
   ctype_ get_fat_body() const {return fat_body;}
+  // fat body at time t >= previous_t, without updating the individual
+  ctype_ get_fat_body_at(time_type t) const {
+    ctype_ fb = fat_body - static_cast<ctype_>(t - previous_t) * metabolic_rate[ static_cast<int>(current_task) ];
+    return fb < 0 ? ctype_(0.0) : fb;
+  }
   ctype_ get_relative_fat_body() const {return fat_body * 1.0 / max_fat_body;}
+  ctype_ get_relative_fat_body_at(time_type t) const {return get_fat_body_at(t) * 1.0 / max_fat_body;}
   ctype_ get_dominance() const {return dominance;}
   ctype_ get_crop() const {return crop;}
-  ctype_ get_previous_t() const {return previous_t;}
-  ctype_ get_next_t() const {return next_t;}
+  time_type get_previous_t() const {return previous_t;}
+  time_type get_next_t() const {return next_t;}
   ctype_ get_threshold() const {return threshold;}
+  size_t get_num_feedings() const {return num_feedings;}
   task get_task() const {return current_task;}
   task get_previous_task() const {return previous_task;}
   const std::vector< data_storage >& get_data() const {return data;}
 
   void set_fat_body(ctype_ fb) {fat_body = fb;}
   void set_crop(ctype_ c) { crop = c;}
-  void set_previous_t(ctype_ t) {previous_t = t;}
+  void set_previous_t(time_type t) {previous_t = t;}
   void set_current_task(task new_task) {current_task = new_task;}
   void set_dominance(ctype_ d) {dominance = d;} // for testing
 
+#ifdef DOL_COUNTERS
+  const counters::event_counts& get_counts() const {return counts;}
+
+  void count_forage_return(size_t num_nurses) {
+    counts.forage_returns++;
+    counts.nurses_at_returns += num_nurses;
+    counts.max_nurses_at_return = std::max<uint64_t>(counts.max_nurses_at_return, num_nurses);
+  }
+#endif
+
+  void add_record(time_type t, task ct, ctype_ fb) {
+    DOL_COUNT(counts.history_records++);
+    // a record before the burn-in replaces the previous one
+    if (drop_burnin_history && t < burnin_t &&
+        !data.empty() && data.back().t_ < burnin_t) {
+      data.pop_back();
+    }
+    data.push_back( data_storage(t, ct, fb));
+  }
+
+  // full state, including the history, for checkpoints. The sharing
+  // function is not stored, it follows from the model of the simulation.
+  void save(std::ostream& out) const {
+    checkpoint::write(out, fat_body);
+    checkpoint::write(out, crop);
+    checkpoint::write(out, previous_t);
+    checkpoint::write(out, next_t);
+    checkpoint::write(out, dominance);
+    checkpoint::write(out, threshold);
+    checkpoint::write(out, max_fat_body);
+    checkpoint::write(out, burnin_t);
+    checkpoint::write<uint64_t>(out, num_feedings);
+    checkpoint::write(out, metabolic_rate);
+    checkpoint::write(out, current_task);
+    checkpoint::write(out, previous_task);
+    checkpoint::write<uint64_t>(out, data.size());
+    for (const auto& i : data) {
+      checkpoint::write(out, i.t_);
+      checkpoint::write(out, i.current_task_);
+      checkpoint::write(out, i.fb_);
+    }
+  }
+
+  void load(std::istream& in) {
+    fat_body       = checkpoint::read<ctype_>(in);
+    crop           = checkpoint::read<ctype_>(in);
+    previous_t     = checkpoint::read<time_type>(in);
+    next_t         = checkpoint::read<time_type>(in);
+    dominance      = checkpoint::read<ctype_>(in);
+    threshold      = checkpoint::read<ctype_>(in);
+    max_fat_body   = checkpoint::read<ctype_>(in);
+    burnin_t       = checkpoint::read<time_type>(in);
+    num_feedings   = checkpoint::read<uint64_t>(in);
+    metabolic_rate = checkpoint::read<decltype(metabolic_rate)>(in);
+    current_task   = checkpoint::read<task>(in);
+    previous_task  = checkpoint::read<task>(in);
+    const auto num_data = checkpoint::read<uint64_t>(in);
+    DOL_COUNT(counts = counters::event_counts());
+    data.clear();
+    data.reserve(num_data);
+    for (size_t i = 0; i < num_data; ++i) {
+      auto t = checkpoint::read<time_type>(in);
+      auto ct = checkpoint::read<task>(in);
+      auto fb = checkpoint::read<ctype_>(in);
+      data.push_back(data_storage(t, ct, fb));
+    }
+  }
+
 
-  void share_resources_grouped(ctype_ t,
+  template <typename RND>
+  void share_resources_grouped(time_type t,
                                std::vector< individual* >& nurses,
                                const params& p,
-                               rnd_t& rndgen) {
+                               RND& rndgen) {
 
     if (nurses.empty()) return;
 
@@ -264,6 +377,7 @@ public:
 
     std::vector< ctype_ > share_amount = share_interaction_grouped(this,
                                                                    nurses,
+                                                                   t,
                                                                    p.soft_max,
                                                                    num_interactions);
 
@@ -273,7 +387,10 @@ public:
         ctype_ to_share = share_amount[i] * total_crop;
 
       if (to_share > 0.0) {
+        // food is added to the fat body at t, not at the last event of the nurse
+        nurses[i]->update_fatbody(t);
 
+        DOL_COUNT(counts.sharing_interactions++);
         ctype_ food_remaining = nurses[i]->handle_food(to_share,
                                                        t,
                                                        p.food_handling_time);
@@ -295,24 +412,27 @@ inline ctype_ get_exp(ctype_ val) {
   return std::exp(val);
 }
 
-std::vector<ctype_> no_sharing_grouped(individual* pivot,
+inline std::vector<ctype_> no_sharing_grouped(individual* pivot,
                           std::vector<individual*> other,
+                          time_type t,
                           ctype_ soft_max,
                           size_t num_interactions)  {
   return std::vector<ctype_>(num_interactions, ctype_(0.0));
 }
 
-std::vector<ctype_> fair_sharing_grouped(individual* pivot,
+inline std::vector<ctype_> fair_sharing_grouped(individual* pivot,
                             std::vector<individual*> other,
+                            time_type t,
                             ctype_ soft_max,
                             size_t num_interactions)  {
   return std::vector<ctype_>(num_interactions, ctype_(1) / ( 1 + num_interactions)); // 1 + for forager
 }
 
-std::vector<ctype_> dominance_sharing_grouped(individual* pivot,
-                                              std::vector<individual*> other,
-                                              ctype_ soft_max,
-                                              size_t num_interactions)  {
+inline std::vector<ctype_> dominance_sharing_grouped(individual* pivot,
+                                                     std::vector<individual*> other,
+                                                     time_type t,
+                                                     ctype_ soft_max,
+                                                     size_t num_interactions)  {
 
   std::vector<ctype_> share(num_interactions);
 
@@ -331,14 +451,15 @@ std::vector<ctype_> dominance_sharing_grouped(individual* pivot,
   return share;
 }
 
-std::vector<ctype_> fatbody_sharing_grouped(individual* pivot,
-                                            std::vector<individual*> other,
-                                            ctype_ soft_max,
-                                            size_t num_interactions)  {
+inline std::vector<ctype_> fatbody_sharing_grouped(individual* pivot,
+                                                   std::vector<individual*> other,
+                                                   time_type t,
+                                                   ctype_ soft_max,
+                                                   size_t num_interactions)  {
   std::vector<ctype_> share(num_interactions);
   ctype_ sum = get_exp(pivot->get_relative_fat_body()  * soft_max);
   for (size_t i = 0; i < num_interactions; ++i) {
-    share[i] = get_exp(other[i]->get_relative_fat_body() * soft_max);
+    share[i] = get_exp(other[i]->get_relative_fat_body_at(t) * soft_max);
     sum += share[i];
   }
 
@@ -12,58 +12,78 @@
 #include "simulation.h"
 #include "individual.h"
 #include "statistics.h"
+#include "output_sink.h"
+#include "aggregate.h"
+#include "pipeline.h"
+#include "trace.h"
 #include <chrono>
 
 int main(int argc, char* argv[]) {
   try {
 
-    std::string file_name = (argc > 2) ? argv[1] : "config.ini";
-
-    std::cout << "reading from config file: " << file_name << "\n";
-    std::ifstream test_file(file_name.c_str());
-    if (!test_file.is_open()) {
-      throw std::runtime_error("can't find config file");
+    // every config file is one point of a parameter sweep
+    std::vector< std::string > file_names;
+    for (int i = 1; i < argc; ++i) {
+      file_names.push_back(argv[i]);
     }
-    test_file.close();
-
-    params sim_par_in(file_name);
+    if (file_names.empty()) file_names.push_back("config.ini");
 
-    output::write_dol_headers(sim_par_in.param_names_to_record,
-                              sim_par_in.dol_file_name,
-                              sim_par_in.window_file_name,
-                              sim_par_in.data_interval);
+    // all points of the sweep write to the output files of the first
+    std::unique_ptr< params > first_par;
+    std::unique_ptr< output::sinks > output_files;
+    std::unique_ptr< aggregate::sweep_summary > summary;
+    std::string trace_file_name;
 
-    for (size_t num_repl = 0; num_repl < sim_par_in.num_replicates; ++num_repl) {
-        std::unique_ptr<Simulation> sim = create_simulation(sim_par_in);
+    auto clock_start = std::chrono::system_clock::now();
 
-        auto clock_start = std::chrono::system_clock::now();
-        sim->run();
+    for (const auto& file_name : file_names) {
+      std::cout << "reading from config file: " << file_name << "\n";
+      std::ifstream test_file(file_name.c_str());
+      if (!test_file.is_open()) {
+        throw std::runtime_error("can't find config file");
+      }
+      test_file.close();
 
+      auto load_start = trace::clock::now();
+      params sim_par_in(file_name);
+      if (!sim_par_in.trace_file.empty()) {
+        // one trace covers all configs from the first that asks for it
+        trace::start();
+        trace_file_name = sim_par_in.trace_file;
+      }
+      trace::record("load config", load_start, trace::clock::now());
 
-        if (sim_par_in.data_interval == 0) {
-          output::write_ants_to_file(sim->colony,
-                                     sim_par_in.output_file_name, num_repl);
-          
-          output::write_dol_sliding_window(sim->colony,
-                                           sim_par_in.window_size,
-                                           sim_par_in.window_step_size,
-                                           static_cast<float>(sim_par_in.simulation_time),
-                                           sim_par_in.window_file_name,
-                                           num_repl);
+      if (!first_par) {
+        first_par = std::make_unique< params >(sim_par_in);
+        // output files stay open for the entire sweep
+        output_files = std::make_unique< output::sinks >(sim_par_in);
+        summary = std::make_unique< aggregate::sweep_summary >(sim_par_in.param_names_to_record);
+      } else {
+        if (!output::same_sinks(*first_par, sim_par_in)) {
+          throw std::runtime_error(file_name + " writes to other output files than " +
+                                   file_names.front() + ", run it as a separate sweep");
         }
+        if (sim_par_in.summary_file_name != first_par->summary_file_name) {
+          throw std::runtime_error(file_name + " sets another summary_file_name than " +
+                                   file_names.front());
+        }
+      }
 
-        output::write_dol_to_file(sim->colony,
-                                  sim_par_in.params_to_record,
-                                  sim_par_in.dol_file_name,
-                                  num_repl,
-                                  sim_par_in.burnin,
-                                  static_cast<float>(sim_par_in.simulation_time));
+      pipeline::run_replicates(sim_par_in, *output_files, *summary);
+    }
 
-      auto clock_now = std::chrono::system_clock::now();
-      std::chrono::duration<double> elapsed_seconds = clock_now - clock_start;
-      std::cout << "this took: " << elapsed_seconds.count() << "seconds\n";
+    if (!first_par->summary_file_name.empty()) {
+      std::ofstream out(first_par->summary_file_name.c_str());
+      summary->write_header(out);
+      summary->write(out);
     }
-    
+
+    if (!trace_file_name.empty()) trace::write(trace_file_name);
+
+    auto clock_now = std::chrono::system_clock::now();
+    std::chrono::duration<double> elapsed_seconds = clock_now - clock_start;
+    std::cout << "this took: " << elapsed_seconds.count() << "seconds\n";
+
     return 0;
   }
   catch (const std::exception& err) {
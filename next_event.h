@@ -0,0 +1,321 @@
+//
+//  next_event.h
+//  dol_fatbody_tj
+//
+
+#ifndef next_event_h
+#define next_event_h
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "cpu_dispatch.h"
+
+#if defined(DOL_DISPATCH) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace next_event {
+
+  // allocator handing out memory aligned to ALIGN bytes, so that the time
+  // array can be read with aligned vector loads.
+  template <typename T, size_t ALIGN = 64>
+  struct aligned_allocator {
+    using value_type = T;
+
+    template <typename U> struct rebind { using other = aligned_allocator<U, ALIGN>; };
+
+    aligned_allocator() = default;
+    template <typename U> aligned_allocator(const aligned_allocator<U, ALIGN>&) {}
+
+    T* allocate(size_t n) {
+      // over-allocate and keep the original pointer just before the block
+      void* raw = std::malloc(n * sizeof(T) + ALIGN + sizeof(void*));
+      if (!raw) throw std::bad_alloc();
+      auto start = reinterpret_cast<uintptr_t>(raw) + sizeof(void*);
+      auto aligned = (start + ALIGN - 1) & ~static_cast<uintptr_t>(ALIGN - 1);
+      reinterpret_cast<void**>(aligned)[-1] = raw;
+      return reinterpret_cast<T*>(aligned);
+    }
+
+    void deallocate(T* p, size_t) {
+      if (p) std::free(reinterpret_cast<void**>(p)[-1]);
+    }
+
+    template <typename U>
+    bool operator==(const aligned_allocator<U, ALIGN>&) const {return true;}
+    template <typename U>
+    bool operator!=(const aligned_allocator<U, ALIGN>&) const {return false;}
+  };
+
+  // lanes per vector of the widest kernel, arrays are padded to a multiple
+  constexpr size_t padding = 16;
+
+  // reference: first index holding the smallest value
+  template <typename T>
+  size_t argmin_scalar(const T* v, size_t n) {
+    size_t best = 0;
+    for (size_t i = 1; i < n; ++i) {
+      if (v[i] < v[best]) best = i;
+    }
+    return best;
+  }
+
+  // reduces per lane minima and their indices; equal values go to the
+  // lowest index, as in argmin_scalar
+  inline size_t reduce_lanes(const float* vals, const int32_t* ids, size_t lanes) {
+    size_t best = 0;
+    for (size_t i = 1; i < lanes; ++i) {
+      if (vals[i] < vals[best] ||
+          (vals[i] == vals[best] && ids[i] < ids[best])) {
+        best = i;
+      }
+    }
+    return static_cast<size_t>(ids[best]);
+  }
+
+#ifdef DOL_DISPATCH
+  // n is a multiple of 16 and v is 64 byte aligned
+  DOL_TARGET("avx512f") inline size_t argmin_avx512(const float* v, size_t n) {
+    __m512 best = _mm512_load_ps(v);
+    __m512i best_idx = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                         8, 9, 10, 11, 12, 13, 14, 15);
+    __m512i idx = best_idx;
+    const __m512i step = _mm512_set1_epi32(16);
+    for (size_t i = 16; i < n; i += 16) {
+      idx = _mm512_add_epi32(idx, step);
+      const __m512 x = _mm512_load_ps(v + i);
+      const __mmask16 m = _mm512_cmp_ps_mask(x, best, _CMP_LT_OQ);
+      best = _mm512_mask_blend_ps(m, best, x);
+      best_idx = _mm512_mask_blend_epi32(m, best_idx, idx);
+    }
+    alignas(64) float vals[16];
+    alignas(64) int32_t ids[16];
+    _mm512_store_ps(vals, best);
+    _mm512_store_si512(reinterpret_cast<__m512i*>(ids), best_idx);
+    return reduce_lanes(vals, ids, 16);
+  }
+
+  // n is a multiple of 8 and v is 32 byte aligned
+  DOL_TARGET("avx2") inline size_t argmin_avx2(const float* v, size_t n) {
+    __m256 best = _mm256_load_ps(v);
+    __m256i best_idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i idx = best_idx;
+    const __m256i step = _mm256_set1_epi32(8);
+    for (size_t i = 8; i < n; i += 8) {
+      idx = _mm256_add_epi32(idx, step);
+      const __m256 x = _mm256_load_ps(v + i);
+      const __m256 m = _mm256_cmp_ps(x, best, _CMP_LT_OQ);
+      best = _mm256_blendv_ps(best, x, m);
+      best_idx = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(best_idx),
+                                                      _mm256_castsi256_ps(idx), m));
+    }
+    alignas(32) float vals[8];
+    alignas(32) int32_t ids[8];
+    _mm256_store_ps(vals, best);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(ids), best_idx);
+    return reduce_lanes(vals, ids, 8);
+  }
+
+  // n is a multiple of 4 and v is 16 byte aligned
+  DOL_TARGET("sse4.2") inline size_t argmin_sse4(const float* v, size_t n) {
+    __m128 best = _mm_load_ps(v);
+    __m128i best_idx = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i idx = best_idx;
+    const __m128i step = _mm_set1_epi32(4);
+    for (size_t i = 4; i < n; i += 4) {
+      idx = _mm_add_epi32(idx, step);
+      const __m128 x = _mm_load_ps(v + i);
+      const __m128 m = _mm_cmplt_ps(x, best);
+      best = _mm_blendv_ps(best, x, m);
+      best_idx = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(best_idx),
+                                                _mm_castsi128_ps(idx), m));
+    }
+    alignas(16) float vals[4];
+    alignas(16) int32_t ids[4];
+    _mm_store_ps(vals, best);
+    _mm_store_si128(reinterpret_cast<__m128i*>(ids), best_idx);
+    return reduce_lanes(vals, ids, 4);
+  }
+#endif
+
+#if defined(__SSE2__)
+  // n is a multiple of 4 and v is 16 byte aligned. SSE2 has no blend, so
+  // we select with and / andnot / or.
+  inline size_t argmin_sse2(const float* v, size_t n) {
+    __m128 best = _mm_load_ps(v);
+    __m128i best_idx = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i idx = best_idx;
+    const __m128i step = _mm_set1_epi32(4);
+    for (size_t i = 4; i < n; i += 4) {
+      idx = _mm_add_epi32(idx, step);
+      const __m128 x = _mm_load_ps(v + i);
+      const __m128 m = _mm_cmplt_ps(x, best);
+      best = _mm_or_ps(_mm_and_ps(m, x), _mm_andnot_ps(m, best));
+      const __m128i mi = _mm_castps_si128(m);
+      best_idx = _mm_or_si128(_mm_and_si128(mi, idx), _mm_andnot_si128(mi, best_idx));
+    }
+    alignas(16) float vals[4];
+    alignas(16) int32_t ids[4];
+    _mm_store_ps(vals, best);
+    _mm_store_si128(reinterpret_cast<__m128i*>(ids), best_idx);
+    return reduce_lanes(vals, ids, 4);
+  }
+#endif
+
+  // kernel of the build's own instruction set
+  inline size_t argmin_generic(const float* v, size_t n) {
+#if defined(__SSE2__)
+    return argmin_sse2(v, n);
+#else
+    return argmin_scalar(v, n);
+#endif
+  }
+
+  // fixed trip count for the common sizes, which lets the compiler unroll
+  // the kernel
+  template <size_t (*kernel)(const float*, size_t)>
+  DOL_KERNEL size_t argmin_sized(const float* v, size_t n) {
+    switch (n) {
+      case 64:  return kernel(v, 64);
+      case 128: return kernel(v, 128);
+      case 256: return kernel(v, 256);
+      case 512: return kernel(v, 512);
+      default:  return kernel(v, n);
+    }
+  }
+
+#ifdef DOL_DISPATCH
+  DOL_TARGET("avx512f") inline size_t argmin_avx512_sized(const float* v, size_t n) {
+    return argmin_sized<argmin_avx512>(v, n);
+  }
+
+  DOL_TARGET("avx2") inline size_t argmin_avx2_sized(const float* v, size_t n) {
+    return argmin_sized<argmin_avx2>(v, n);
+  }
+
+  DOL_TARGET("sse4.2") inline size_t argmin_sse4_sized(const float* v, size_t n) {
+    return argmin_sized<argmin_sse4>(v, n);
+  }
+#endif
+
+  // variant of the active instruction set, all return the same index.
+  // n is a multiple of padding.
+  inline size_t argmin(const float* v, size_t n) {
+#ifdef DOL_DISPATCH
+    switch (cpu::active()) {
+      case cpu::isa::avx512:  return argmin_avx512_sized(v, n);
+      case cpu::isa::avx2:    return argmin_avx2_sized(v, n);
+      case cpu::isa::sse4_2:  return argmin_sse4_sized(v, n);
+      case cpu::isa::generic: break;
+    }
+#endif
+    return argmin_sized<argmin_generic>(v, n);
+  }
+
+  template <typename T>
+  size_t argmin(const T* v, size_t n) {
+    return argmin_scalar(v, n);
+  }
+
+  // Keeps the next event time of every individual in a dense, aligned
+  // array, padded with the largest value (not inf, which -ffast-math
+  // assumes away). The caller updates the entries of all
+  // individuals whose next event time changes.
+  template <typename T>
+  class simd_selector {
+  public:
+    void resize(size_t n) {
+      n_ = n;
+      size_t padded = (n + padding - 1) / padding * padding;
+      times_.assign(padded > 0 ? padded : padding, std::numeric_limits<T>::max());
+    }
+
+    void set(size_t i, T t) {times_[i] = t;}
+    T get(size_t i) const {return times_[i];}
+    size_t size() const {return n_;}
+
+    // index of the first individual with the earliest next event
+    size_t argmin() const {
+      return next_event::argmin(times_.data(), times_.size());
+    }
+
+  private:
+    size_t n_ = 0;
+    std::vector<T, aligned_allocator<T>> times_;
+  };
+
+  // Monotone priority queue on integer keys (radix heap, Ahuja et al. 1990).
+  // Keys pushed may not be smaller than the last key popped, which holds
+  // for event times. An item is kept in the bucket of the highest bit in
+  // which its key differs from the last popped key, so that no keys are
+  // compared and each item moves to a lower bucket at most 64 times.
+  template <typename V>
+  class radix_heap {
+  public:
+    using item = std::pair<uint64_t, V>;
+
+    void push(uint64_t key, V value) {
+      assert(key >= last_);
+      buckets_[bucket(key)].emplace_back(key, value);
+      size_++;
+    }
+
+    // item with the smallest key
+    const item& top() {
+      if (buckets_[0].empty()) refill();
+      return buckets_[0].back();
+    }
+
+    void pop() {
+      if (buckets_[0].empty()) refill();
+      buckets_[0].pop_back();
+      size_--;
+    }
+
+    bool empty() const {return size_ == 0;}
+    size_t size() const {return size_;}
+    uint64_t last_key() const {return last_;}
+
+    // empties the heap, later keys should be at least last
+    void clear(uint64_t last = 0) {
+      for (auto& b : buckets_) b.clear();
+      last_ = last;
+      size_ = 0;
+    }
+
+  private:
+    size_t bucket(uint64_t key) const {
+      return key == last_ ? 0 : 64 - static_cast<size_t>(__builtin_clzll(key ^ last_));
+    }
+
+    // moves the first non-empty bucket down, its smallest key ends up in 0
+    void refill() {
+      assert(size_ > 0);
+      size_t i = 1;
+      while (buckets_[i].empty()) ++i;
+      uint64_t new_last = buckets_[i][0].first;
+      for (const auto& j : buckets_[i]) {
+        if (j.first < new_last) new_last = j.first;
+      }
+      last_ = new_last;
+      for (const auto& j : buckets_[i]) {
+        buckets_[bucket(j.first)].push_back(j);
+      }
+      buckets_[i].clear();
+    }
+
+    std::array<std::vector<item>, 65> buckets_;
+    uint64_t last_ = 0;
+    size_t size_ = 0;
+  };
+}
+
+#endif /* next_event_h */
@@ -0,0 +1,75 @@
+//
+//  observer.h
+//  dol_fatbody_tj
+//
+//  Read-only view of a colony during a run, to couple the colony to
+//  other models or to compute statistics between calls to run_until.
+//  Nothing is copied or changed: fat bodies are evaluated at the current
+//  time of the simulation, and histories are returned by reference.
+//
+
+#ifndef observer_h
+#define observer_h
+
+#include <array>
+#include <vector>
+
+#include "individual.h"
+#include "simulation.h"
+
+// state of one ant at the time of the observer
+struct ant_state {
+  task current_task;
+  ctype_ fat_body;
+  ctype_ dominance;
+  ctype_ threshold;
+  time_type next_t;        // time of its next event
+  size_t num_feedings;
+  size_t num_records;      // length of its history
+};
+
+class colony_observer {
+public:
+  explicit colony_observer(const Simulation& sim) : sim_(sim) {}
+
+  time_type time() const {return sim_.t;}
+  size_t size() const {return sim_.colony.size();}
+
+  // number of ants per task
+  std::array<size_t, static_cast<int>(task::max_task)> task_counts() const {
+    std::array<size_t, static_cast<int>(task::max_task)> counts{};
+    for (const auto& i : sim_.colony) counts[static_cast<int>(i.get_task())]++;
+    return counts;
+  }
+
+  ctype_ fat_body(size_t ant) const {
+    return sim_.colony[ant].get_fat_body_at(time());
+  }
+
+  // fat bodies of all ants; out keeps its memory between calls
+  void fat_bodies(std::vector<ctype_>& out) const {
+    out.resize(sim_.colony.size());
+    const time_type now = time();
+    for (size_t i = 0; i < sim_.colony.size(); ++i) {
+      out[i] = sim_.colony[i].get_fat_body_at(now);
+    }
+  }
+
+  ant_state ant(size_t i) const {
+    const auto& a = sim_.colony[i];
+    return {a.get_task(), a.get_fat_body_at(time()), a.get_dominance(),
+            a.get_threshold(), a.get_next_t(), a.get_num_feedings(),
+            a.get_data().size()};
+  }
+
+  const std::vector< data_storage >& history(size_t ant) const {
+    return sim_.colony[ant].get_data();
+  }
+
+  const std::vector< data_storage >& snapshots() const {return sim_.snapshots;}
+
+private:
+  const Simulation& sim_;
+};
+
+#endif /* observer_h */
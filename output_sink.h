@@ -0,0 +1,163 @@
+//
+//  output_sink.h
+//  dol_fatbody_tj
+//
+
+#ifndef output_sink_h
+#define output_sink_h
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "parameters.h"
+#include "counters.h"
+
+namespace output {
+
+  inline std::string dol_header(const std::vector<std::string>& param_names,
+                                bool shared_burnin = false) {
+    std::string header = "repl\t";
+    if (shared_burnin) header += "burnin_source\t";
+    for (const auto& i : param_names) {
+      header += i + "\t";
+    }
+    header += "gautrais\tduarte\tgorelick_tasks\tgorelick_indiv\tgorelick_both\n";
+    return header;
+  }
+
+  inline std::string window_header() {
+    return "repl\tmin_t\tmax_t\tgautrais\tduarte\tgorelick_tasks\tgorelick_indiv\tgorelick_both\n";
+  }
+
+  inline std::string ants_header() {
+    return "replicate\tID\ttime\ttask\tfat_body\tdominance\n";
+  }
+
+  inline std::string ants_summary_header() {
+    return "replicate\tID\tnurse_share\tforage_share\tnum_switches\tmean_fat_body\tmin_fat_body\tnum_feedings\tdominance\n";
+  }
+
+  inline std::string snapshot_header() {
+    return "replicate\ttime\tID\ttask\tfat_body\n";
+  }
+
+  // An output file that stays open for the entire run. The file is
+  // truncated and the header written on construction. Writes go through a
+  // large user supplied buffer; everything written before flush() has been
+  // handed to the operating system once flush() returns, so flushing at
+  // replicate boundaries leaves only whole replicates behind when the
+  // program dies. There is no fsync, so a crash of the machine itself can
+  // still lose recent rows.
+  // A sink constructed with an empty file name is disabled and ignores
+  // all writes.
+  class sink {
+  public:
+    sink() {}
+
+    sink(const std::string& file_name,
+         const std::string& header,
+         size_t buffer_size = size_t{1} << 20) {
+      open(file_name, header, buffer_size);
+    }
+
+    sink(const sink&) = delete;
+    sink& operator=(const sink&) = delete;
+
+    void open(const std::string& file_name,
+              const std::string& header,
+              size_t buffer_size = size_t{1} << 20) {
+      if (file_name.empty()) return;
+      buffer_.resize(buffer_size);
+      // the buffer has to be installed before the file is opened
+      out_.rdbuf()->pubsetbuf(buffer_.data(),
+                              static_cast<std::streamsize>(buffer_.size()));
+      out_.open(file_name.c_str(), std::ios::out | std::ios::trunc);
+      if (!out_.is_open()) {
+        throw std::runtime_error("can't open output file: " + file_name);
+      }
+      file_name_ = file_name;
+      out_ << header;
+      flush();
+    }
+
+    void write(const std::string& s) {
+      if (!enabled()) return;
+      out_.write(s.data(), static_cast<std::streamsize>(s.size()));
+    }
+
+    void flush() {
+      if (!enabled()) return;
+      out_.flush();
+      if (!out_) {
+        throw std::runtime_error("failed writing to: " + file_name_);
+      }
+    }
+
+    bool enabled() const {return out_.is_open();}
+    const std::string& file_name() const {return file_name_;}
+
+  private:
+    std::vector<char> buffer_;
+    std::ofstream out_;
+    std::string file_name_;
+  };
+
+  // true when sinks(a) and sinks(b) open the same files with the same
+  // headers, so that both can write to one set of sinks
+  inline bool same_sinks(const params& a, const params& b) {
+    if (a.dol_file_name != b.dol_file_name ||
+        a.param_names_to_record != b.param_names_to_record ||
+        (a.shared_burnin > 0) != (b.shared_burnin > 0) ||
+        a.write_ant_output() != b.write_ant_output() ||
+        (a.data_interval > 0) != (b.data_interval > 0)) {
+      return false;
+    }
+    if (a.write_ant_output() &&
+        (a.output_file_name != b.output_file_name ||
+         a.ant_output_type != b.ant_output_type)) {
+      return false;
+    }
+    return a.data_interval > 0 ? a.snapshot_file_name == b.snapshot_file_name :
+                                 a.window_file_name == b.window_file_name;
+  }
+
+  // all output files of a run, created once in main
+  struct sinks {
+    sink dol;
+    sink ants;
+    sink window;
+    sink snapshots;
+    sink counters;  // only with counters compiled in
+
+    explicit sinks(const params& p) {
+      dol.open(p.dol_file_name, dol_header(p.param_names_to_record, p.shared_burnin > 0));
+      if (p.write_ant_output()) {
+        ants.open(p.output_file_name,
+                  p.ant_output_type == ant_output::summary ? ants_summary_header() :
+                                                            ants_header());
+      }
+      if (p.data_interval == 0) {
+        window.open(p.window_file_name, window_header());
+      }
+      if (p.data_interval > 0) {
+        snapshots.open(p.snapshot_file_name, snapshot_header());
+      }
+      if (counters::enabled) {
+        counters.open(counters::file_name(p.dol_file_name), counters::header());
+      }
+    }
+
+    // called at replicate boundaries
+    void flush() {
+      dol.flush();
+      ants.flush();
+      window.flush();
+      snapshots.flush();
+      counters.flush();
+    }
+  };
+}
+
+#endif /* output_sink_h */
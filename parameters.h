@@ -9,15 +9,37 @@
 #ifndef parameters_h
 #define parameters_h
 
-// #include <cmath>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
 #include "config_parser.h"
+#include "cpu_dispatch.h"
 #include <string>
 #include <vector>
 
+// Precision of the simulation, chosen at compile time (make PRECISION=...).
+// ctype_ holds the state of individuals and the parameters, time_type the
+// clock and all event times. Statistics accumulate in stat_type.
+#if defined(DOL_DOUBLE_PRECISION)
+using ctype_ = double;
+using time_type = double;
+#elif defined(DOL_MIXED_PRECISION)
 using ctype_ = float;
+using time_type = double;
+#else
+using ctype_ = float;
+using time_type = float;
+#endif
+using stat_type = double;
 
 enum share_model {no, fair, dominance, fat_body, max_model};
 
+enum class ant_output {trajectory, summary}; // what is written to output_file_name
+
+enum class scheduler_type {scan, simd, radix};  // how the next event of the colony is found
+
+enum class history_retention {all, after_burnin}; // which events are kept in the history of an ant
+
 struct params {
 
   params() {};
@@ -29,9 +51,11 @@ struct params {
   std::string dol_file_name = "dol_default.txt";
   std::string output_file_name = "output_default.txt";
   std::string window_file_name = "window_default.txt";
+  std::string snapshot_file_name = "snapshot_default.txt";
+  std::string summary_file_name;  // DoL summary across replicates, not written when empty
 
   size_t simulation_time = 10000; // length of simulation
-  int data_interval = 1; // data is written simulationTime / dataInterval times
+  int data_interval = 1; // 0: write all events, > 0: write a colony snapshot every data_interval time units
   size_t colony_size = 100; // number of individuals per colony
 
   share_model model_type = share_model::fat_body; // 0 = no sharing, 1 = random sharing, 2 = dominance sharing, 3 = changing dominance
@@ -57,6 +81,30 @@ struct params {
 
   ctype_ soft_max = 1.0;
 
+  ant_output ant_output_type = ant_output::trajectory;
+  std::string focal_ants; // ants for which the trajectory is written: empty (all), a list of IDs "0,4,7" or a fraction "0.1"
+
+  size_t num_sim_threads = 1;       // replicates simulated concurrently
+  size_t num_analysis_threads = 1;  // threads calculating statistics and formatting output
+  size_t queue_size = 2;            // max number of replicates waiting between pipeline stages
+
+  size_t num_colony_threads = 1;    // > 1: events within one colony are processed in parallel
+  bool per_ant_rng = false;         // every individual draws from its own random stream
+  size_t seed = 0;                  // 0: seed from the clock and random_device
+  size_t batch_size = 1;            // > 1: replicates simulated in lockstep per simulation thread
+  scheduler_type scheduler = scheduler_type::scan;
+  double time_resolution = 0.001;   // length of one clock tick, used with scheduler = radix
+  ctype_ checkpoint_interval = 0.f; // > 0: save the state of a replicate every checkpoint_interval time units
+  std::string checkpoint_file_name = "checkpoint"; // checkpoints go to <name>_<params_to_record values>_<replicate>.bin
+  bool resume = false;              // continue replicates from their checkpoints, when present
+  size_t shared_burnin = 0;         // > 0: replicates branch off this many shared burn-ins
+  history_retention retain_history = history_retention::all; // after_burnin (1): drop unused records before the burn-in
+  std::string trace_file;           // non-empty: write a Chrome trace of the run to this file
+  bool hw_counters = false;         // report hardware performance counters per replicate phase (Linux)
+  std::string metrics_file;         // non-empty: keep progress metrics in this file, in Prometheus text format
+  double metrics_interval = 10.0;   // seconds between updates of metrics_file
+  cpu::isa max_isa = cpu::isa::avx512; // widest instruction set of the vector kernels: 0 generic, 1 sse4.2, 2 avx2, 3 avx512
+
   std::string temp_params_to_record;
   std::vector < std::string > param_names_to_record;
   std::vector < ctype_ > params_to_record;
@@ -67,6 +115,8 @@ struct params {
     dol_file_name                 = from_config.getValueOfKey<std::string>("dol_file_name");
     output_file_name              = from_config.getValueOfKey<std::string>("output_file_name");
     window_file_name              = from_config.getValueOfKey<std::string>("window_file_name");
+    snapshot_file_name            = from_config.getValueOfKey<std::string>("snapshot_file_name", snapshot_file_name);
+    summary_file_name             = from_config.getValueOfKey<std::string>("summary_file_name", summary_file_name);
     simulation_time               = from_config.getValueOfKey<size_t>("simulation_time");
     data_interval                 = from_config.getValueOfKey<int>("data_interval");
     colony_size                   = from_config.getValueOfKey<size_t>("colony_size");
@@ -89,9 +139,30 @@ struct params {
     window_size                   = from_config.getValueOfKey<ctype_>("window_size");
     window_step_size              = from_config.getValueOfKey<ctype_>("window_step_size");
     soft_max                      = from_config.getValueOfKey<ctype_>("soft_max");
+    ant_output_type               = static_cast<ant_output>(from_config.getValueOfKey<size_t>("ant_output", static_cast<size_t>(ant_output_type)));
+    focal_ants                    = from_config.getValueOfKey<std::string>("focal_ants", focal_ants);
+    num_sim_threads               = from_config.getValueOfKey<size_t>("num_sim_threads", num_sim_threads);
+    num_analysis_threads          = from_config.getValueOfKey<size_t>("num_analysis_threads", num_analysis_threads);
+    queue_size                    = from_config.getValueOfKey<size_t>("queue_size", queue_size);
+    num_colony_threads            = from_config.getValueOfKey<size_t>("num_colony_threads", num_colony_threads);
+    per_ant_rng                   = from_config.getValueOfKey<bool>("per_ant_rng", per_ant_rng);
+    seed                          = from_config.getValueOfKey<size_t>("seed", seed);
+    batch_size                    = from_config.getValueOfKey<size_t>("batch_size", batch_size);
+    scheduler                     = static_cast<scheduler_type>(from_config.getValueOfKey<size_t>("scheduler", static_cast<size_t>(scheduler)));
+    time_resolution               = from_config.getValueOfKey<double>("time_resolution", time_resolution);
+    checkpoint_interval           = from_config.getValueOfKey<ctype_>("checkpoint_interval", checkpoint_interval);
+    checkpoint_file_name          = from_config.getValueOfKey<std::string>("checkpoint_file_name", checkpoint_file_name);
+    resume                        = from_config.getValueOfKey<bool>("resume", resume);
+    shared_burnin                 = from_config.getValueOfKey<size_t>("shared_burnin", shared_burnin);
+    retain_history                = static_cast<history_retention>(from_config.getValueOfKey<size_t>("retain_history", static_cast<size_t>(retain_history)));
+    trace_file                    = from_config.getValueOfKey<std::string>("trace_file", trace_file);
+    hw_counters                   = from_config.getValueOfKey<bool>("hw_counters", hw_counters);
+    metrics_file                  = from_config.getValueOfKey<std::string>("metrics_file", metrics_file);
+    metrics_interval              = from_config.getValueOfKey<double>("metrics_interval", metrics_interval);
+    max_isa                       = static_cast<cpu::isa>(std::min<size_t>(from_config.getValueOfKey<size_t>("max_isa", static_cast<size_t>(max_isa)), static_cast<size_t>(cpu::isa::avx512)));
   }
 
-  std::vector< std::string > split(std::string s) {
+  std::vector< std::string > split(std::string s) const {
     // code from: https://stackoverflow.com/questions/14265581/parse-split-a-string-in-c-using-string-delimiter-standard-c
     std::vector< std::string > output;
     std::string delimiter = ",";
@@ -106,6 +177,66 @@ struct params {
     return output;
   }
 
+  // IDs of the ants whose trajectory is written to output_file_name
+  std::vector< size_t > get_focal_ants() const {
+    std::vector< size_t > output;
+    if (focal_ants.empty()) {
+      for (size_t i = 0; i < colony_size; ++i) output.push_back(i);
+      return output;
+    }
+
+    auto entries = split(focal_ants);
+    if (entries.size() == 1 && entries[0].find('.') != std::string::npos) {
+      // fraction of the colony, ants are exchangeable so we take the first ones
+      double frac = std::stod(entries[0]);
+      if (frac < 0.0 || frac > 1.0) {
+        throw std::runtime_error("focal_ants fraction should be in [0, 1]");
+      }
+      size_t num_focal = static_cast<size_t>(std::ceil(frac * colony_size));
+      for (size_t i = 0; i < num_focal; ++i) output.push_back(i);
+      return output;
+    }
+
+    for (const auto& i : entries) {
+      size_t id = std::stoul(i);
+      if (id >= colony_size) {
+        throw std::runtime_error("focal ant ID larger than colony size");
+      }
+      output.push_back(id);
+    }
+    std::sort(output.begin(), output.end());
+    output.erase(std::unique(output.begin(), output.end()), output.end());
+    return output;
+  }
+
+  // per ant output (trajectories or summaries) is written when all events
+  // are recorded, when focal ants are set explicitly or in summary mode
+  bool write_ant_output() const {
+    return data_interval == 0 || !focal_ants.empty() ||
+           ant_output_type == ant_output::summary;
+  }
+
+  // With after_burnin, only the last event before the burn-in is kept per
+  // ant, unless something reads the earlier ones: the statistics only
+  // cover the time after the burn-in, but trajectories and the sliding
+  // window (data_interval = 0) cover the entire run.
+  bool drop_burnin_history() const {
+    return retain_history == history_retention::after_burnin && data_interval != 0 &&
+           !(write_ant_output() && ant_output_type == ant_output::trajectory);
+  }
+
+  // the lockstep batch engine uses the scan scheduler and does not write
+  // checkpoints; other settings are rejected instead of ignored
+  bool use_batch_engine() const {
+    if (batch_size <= 1) return false;
+    if (scheduler != scheduler_type::scan || num_colony_threads > 1 ||
+        checkpoint_interval > 0 || resume) {
+      throw std::runtime_error("batch_size > 1 needs scheduler = 0 and num_colony_threads = 1, "
+                               "without checkpoints or resume");
+    }
+    return true;
+  }
+
   std::vector< ctype_ > create_params_to_record(const std::vector< std::string >& param_names) {
     std::vector< ctype_ > output;
     for (auto i : param_names) {
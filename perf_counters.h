@@ -0,0 +1,165 @@
+//
+//  perf_counters.h
+//  dol_fatbody_tj
+//
+//  Hardware performance counters of the calling thread, read through
+//  perf_event_open on Linux. Used with hw_counters = 1 to report cycles,
+//  instructions, cache and branch misses per phase of a replicate.
+//  Counters the kernel or the machine does not provide (no permission,
+//  virtual machines, other systems) are reported as unavailable, and the
+//  run continues without them.
+//
+
+#ifndef perf_counters_h
+#define perf_counters_h
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace perf {
+
+  enum counter {cycles, instructions, l1d_misses, llc_misses, branch_misses,
+                task_clock, max_counter};
+
+  inline const char* counter_name(size_t c) {
+    static const char* names[] = {"cycles", "instructions", "l1d_misses",
+                                  "llc_misses", "branch_misses", "task_clock_ns"};
+    return names[c];
+  }
+
+  // counts over a phase; a counter that could not be opened is not valid
+  struct reading {
+    std::array<double, max_counter> value{};
+    std::array<bool, max_counter> valid{};
+
+    reading scaled(double f) const {
+      reading r = *this;
+      for (auto& i : r.value) i *= f;
+      return r;
+    }
+  };
+
+  inline void write(std::ostream& out, const reading& r) {
+    for (size_t i = 0; i < max_counter; ++i) {
+      out << " " << counter_name(i) << "=";
+      if (r.valid[i]) out << static_cast<uint64_t>(r.value[i]); else out << "n/a";
+    }
+    if (r.valid[cycles] && r.valid[instructions] && r.value[cycles] > 0) {
+      out << " ipc=" << r.value[instructions] / r.value[cycles];
+    }
+  }
+
+  // One set of counters for the thread that creates it. Counters run from
+  // construction on; a phase is the difference of two reads.
+  class thread_counters {
+  public:
+    thread_counters() {
+      fd_.fill(-1);
+#ifdef __linux__
+      // {type, config}
+      const std::array<std::array<uint64_t, 2>, max_counter> events = {{
+        {{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES}},
+        {{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS}},
+        {{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)}},
+        {{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES}},
+        {{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}},
+        {{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK}}
+      }};
+      for (size_t i = 0; i < max_counter; ++i) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = static_cast<uint32_t>(events[i][0]);
+        attr.config = events[i][1];
+        attr.exclude_kernel = 1;  // allowed with perf_event_paranoid <= 2
+        attr.exclude_hv = 1;
+        // counters share the PMU with other processes: the time a counter
+        // was enabled and running is used to scale its count
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fd_[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if (fd_[i] < 0 && error_.empty()) {
+          error_ = std::string(counter_name(i)) + ": " + std::strerror(errno);
+        }
+      }
+#else
+      error_ = "perf_event_open is only available on Linux";
+#endif
+    }
+
+    ~thread_counters() {
+#ifdef __linux__
+      for (auto fd : fd_) if (fd >= 0) close(fd);
+#endif
+    }
+
+    thread_counters(const thread_counters&) = delete;
+    thread_counters& operator=(const thread_counters&) = delete;
+
+    reading read() const {
+      reading r;
+#ifdef __linux__
+      for (size_t i = 0; i < max_counter; ++i) {
+        uint64_t v[3];  // value, time enabled, time running
+        if (fd_[i] < 0 || ::read(fd_[i], v, sizeof(v)) != sizeof(v)) continue;
+        r.valid[i] = true;
+        r.value[i] = v[2] > 0 ? static_cast<double>(v[0]) * v[1] / v[2] : 0.0;
+      }
+#endif
+      return r;
+    }
+
+    // first counter that could not be opened, empty if none
+    const std::string& error() const {return error_;}
+
+  private:
+    std::array<int, max_counter> fd_;
+    std::string error_;
+  };
+
+  // counters of the calling thread, opened on first use
+  inline thread_counters& local_counters() {
+    thread_local thread_counters counters;
+    return counters;
+  }
+
+  // b - a, for counters valid in both
+  inline reading difference(const reading& a, const reading& b) {
+    reading r;
+    for (size_t i = 0; i < max_counter; ++i) {
+      r.valid[i] = a.valid[i] && b.valid[i];
+      r.value[i] = r.valid[i] ? b.value[i] - a.value[i] : 0.0;
+    }
+    return r;
+  }
+
+  // counts of a phase on the calling thread. Worker threads of the
+  // parallel colony engine are not included.
+  class phase {
+  public:
+    explicit phase(bool active) : active_(active) {
+      if (active_) start_ = local_counters().read();
+    }
+
+    reading stop() const {
+      return active_ ? difference(start_, local_counters().read()) : reading();
+    }
+
+  private:
+    bool active_;
+    reading start_;
+  };
+}
+
+#endif /* perf_counters_h */
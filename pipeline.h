@@ -0,0 +1,503 @@
+//
+//  pipeline.h
+//  dol_fatbody_tj
+//
+
+#ifndef pipeline_h
+#define pipeline_h
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "parameters.h"
+#include "simulation.h"
+#include "batch_simulation.h"
+#include "statistics.h"
+#include "output_sink.h"
+#include "aggregate.h"
+#include "checkpoint.h"
+#include "counters.h"
+#include "cpu_dispatch.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "progress.h"
+
+namespace pipeline {
+
+  // fixed capacity queue between two pipeline stages. push blocks when the
+  // queue is full, pop blocks when it is empty. After close(), push fails and
+  // pop drains the remaining items before failing.
+  template <typename T>
+  class bounded_queue {
+  public:
+    explicit bounded_queue(size_t capacity) :
+      capacity_(capacity > 0 ? capacity : 1) {}
+
+    bool push(T item) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_full_.wait(lock, [this]{ return queue_.size() < capacity_ || closed_; });
+      if (closed_) return false;
+      queue_.push_back(std::move(item));
+      not_empty_.notify_one();
+      return true;
+    }
+
+    bool pop(T& item) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_empty_.wait(lock, [this]{ return !queue_.empty() || closed_; });
+      if (queue_.empty()) return false;
+      item = std::move(queue_.front());
+      queue_.pop_front();
+      not_full_.notify_one();
+      return true;
+    }
+
+    void close() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+      not_full_.notify_all();
+      not_empty_.notify_all();
+    }
+
+    size_t capacity() const {return capacity_;}
+
+  private:
+    const size_t capacity_;
+    bool closed_ = false;
+    std::deque<T> queue_;
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+  };
+
+  // simulation -> analysis
+  struct finished_replicate {
+    size_t repl = 0;
+    std::unique_ptr<Simulation> sim;
+    counters::phase_times times;
+    perf::reading hw_simulation;  // with hw_counters
+  };
+
+  // analysis -> writer
+  struct formatted_replicate {
+    size_t repl = 0;
+    stats::dol_metrics dol_values;
+    std::string dol;
+    std::string ants;
+    std::string window;
+    std::string snapshots;
+    std::string counters;
+    std::string log;
+  };
+
+  // keeps the first exception thrown by any stage, and shuts the
+  // queues down so that all other stages finish.
+  struct error_state {
+    std::mutex mutex;
+    std::exception_ptr error;
+
+    void set(std::exception_ptr e) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) error = e;
+    }
+  };
+
+  // Admits replicates to the simulation stage only up to size ahead of the
+  // first one the writer has not written yet. Replicates finish out of
+  // order and wait for the earlier ones in the writer, so without this a
+  // single slow replicate would let all later ones pile up there.
+  class write_window {
+  public:
+    explicit write_window(size_t size) : size_(std::max<size_t>(size, 1)) {}
+
+    // blocks until replicate repl may start, false after close()
+    bool admit(size_t repl) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      moved_.wait(lock, [&]() { return closed_ || repl < next_written_ + size_; });
+      return !closed_;
+    }
+
+    // all replicates before next_written have been written
+    void written(size_t next_written) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        next_written_ = next_written;
+      }
+      moved_.notify_all();
+    }
+
+    void close() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+      }
+      moved_.notify_all();
+    }
+
+  private:
+    const size_t size_;
+    size_t next_written_ = 0;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable moved_;
+  };
+
+  inline size_t replicate_seed(const params& p, size_t repl) {
+    return p.seed == 0 ? 0 : p.seed + repl; // reproducible, but different replicates
+  }
+
+  inline std::unique_ptr<Simulation> create_replicate(const params& p, size_t repl) {
+    params repl_par = p;
+    repl_par.seed = replicate_seed(p, repl);
+    return create_simulation(repl_par);
+  }
+
+  // Simulations whose replicate has been analysed. They are reset for a
+  // later replicate, so that the colony and the histories, grown to the
+  // size of an earlier replicate, do not have to be allocated again.
+  class simulation_pool {
+  public:
+    std::unique_ptr<Simulation> acquire(const params& p, size_t repl) {
+      std::unique_ptr<Simulation> sim;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_.empty()) {
+          sim = std::move(free_.back());
+          free_.pop_back();
+        }
+      }
+      if (!sim) return create_replicate(p, repl);
+      sim->reset(replicate_seed(p, repl));
+      return sim;
+    }
+
+    void release(std::unique_ptr<Simulation> sim) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      free_.push_back(std::move(sim));
+    }
+
+  private:
+    std::mutex mutex_;
+    std::vector< std::unique_ptr<Simulation> > free_;
+  };
+
+  // Runs p.shared_burnin colonies up to burnin * simulation_time and keeps
+  // their state. Replicate r branches off burn-in r % shared_burnin.
+  inline std::vector< std::string > run_burnins(const params& p) {
+    std::vector< std::string > states;
+    for (size_t k = 0; k < p.shared_burnin; ++k) {
+      params burnin_par = p;
+      // streams differ from those of all replicates
+      if (burnin_par.seed != 0) burnin_par.seed += p.num_replicates + k;
+      trace::scope s("shared burn-in");
+      auto sim = create_simulation(burnin_par);
+      sim->run_until(p.burnin * static_cast<time_type>(p.simulation_time));
+      std::ostringstream state(std::ios::binary);
+      sim->save_state(state);
+      states.push_back(state.str());
+    }
+    return states;
+  }
+
+  // a copy of a shared burn-in, with its own random streams
+  inline void branch_replicate(Simulation& sim, const params& p, size_t repl,
+                               const std::vector< std::string >& burnins) {
+    std::istringstream state(burnins[repl % burnins.size()], std::ios::binary);
+    sim.load_state(state);
+    sim.reseed(replicate_seed(p, repl));
+  }
+
+  inline void simulate_stage(const params& p,
+                             const std::vector< std::string >& burnins,
+                             simulation_pool& sims,
+                             std::atomic<size_t>& next_repl,
+                             write_window& window,
+                             bounded_queue<finished_replicate>& out,
+                             progress::slot* slot) {
+    const size_t batch_size = p.use_batch_engine() ? p.batch_size : 1;
+    while (true) {
+      size_t first_repl = next_repl.fetch_add(batch_size);
+      if (first_repl >= p.num_replicates) return;
+      size_t last_repl = std::min(first_repl + batch_size, p.num_replicates);
+      if (!window.admit(last_repl - 1)) return;
+
+      auto clock_start = std::chrono::system_clock::now();
+      std::vector< finished_replicate > results(last_repl - first_repl);
+      for (size_t i = 0; i < results.size(); ++i) {
+        results[i].repl = first_repl + i;
+        results[i].sim = sims.acquire(p, first_repl + i);
+        results[i].sim->progress_slot = slot;
+        if (!burnins.empty()) {
+          branch_replicate(*results[i].sim, p, first_repl + i, burnins);
+        }
+        if (p.checkpoint_interval > 0) {
+          const auto file_name = checkpoint::file_name(p, first_repl + i);
+          if (p.resume && std::ifstream(file_name).good()) {
+            results[i].sim->load_checkpoint(file_name);
+            std::ostringstream msg;
+            msg << "replicate " << first_repl + i << " resumes from " << file_name
+                << " at t = " << results[i].sim->t << "\n";
+            std::cout << msg.str();
+          }
+          results[i].sim->enable_checkpoints(file_name);
+        }
+      }
+
+      if (slot) {
+        slot->t.store(static_cast<double>(results[0].sim->t), std::memory_order_relaxed);
+        slot->running.store(true, std::memory_order_relaxed);
+      }
+      perf::phase hw(p.hw_counters);
+      if (results.size() > 1) {
+        std::vector< Simulation* > lanes;
+        for (auto& i : results) lanes.push_back(i.sim.get());
+        BatchSimulation batch(lanes);
+        batch.run();
+      } else {
+        results[0].sim->run();
+      }
+
+      const auto hw_simulation = hw.stop().scaled(1.0 / results.size());
+      if (slot) slot->running.store(false, std::memory_order_relaxed);
+
+      auto clock_now = std::chrono::system_clock::now();
+      std::chrono::duration<double> elapsed_seconds = clock_now - clock_start;
+      std::ostringstream msg;
+      msg << "replicate " << first_repl;
+      if (results.size() > 1) msg << " - " << last_repl - 1;
+      msg << " simulation took: " << elapsed_seconds.count() << "seconds\n";
+      std::cout << msg.str();
+
+      for (auto& i : results) {
+        i.times.simulation = elapsed_seconds.count() / results.size();
+        i.hw_simulation = hw_simulation;
+        if (!out.push(std::move(i))) return;
+      }
+    }
+  }
+
+  inline void analysis_stage(const params& p,
+                             simulation_pool& sims,
+                             bounded_queue<finished_replicate>& in,
+                             bounded_queue<formatted_replicate>& out) {
+    const auto focal_ants = p.get_focal_ants();
+    finished_replicate item;
+    while (in.pop(item)) {
+      trace::scope s("analyse replicate");
+      const auto& colony = item.sim->colony;
+      formatted_replicate result;
+      result.repl = item.repl;
+
+      const time_type min_t = p.burnin * static_cast<time_type>(p.simulation_time);
+      const time_type max_t = static_cast<time_type>(p.simulation_time);
+      auto phase_start = std::chrono::steady_clock::now();
+      perf::phase hw(p.hw_counters);
+      auto dol = stats::calculate_dol(colony, min_t, max_t);
+      const auto hw_statistics = hw.stop();
+      result.dol_values = dol;
+      if (counters::enabled) {
+        auto now = std::chrono::steady_clock::now();
+        item.times.statistics = std::chrono::duration<double>(now - phase_start).count();
+        phase_start = now;
+      }
+
+      std::ostringstream dol_out;
+      const long burnin_source = p.shared_burnin > 0 ?
+                                 static_cast<long>(item.repl % p.shared_burnin) : -1;
+      output::write_dol(dol_out, p.params_to_record, item.repl, dol, burnin_source);
+      result.dol = dol_out.str();
+
+      const perf::phase hw_output(p.hw_counters);
+      std::ostringstream log_out;
+      log_out << "replicate " << item.repl;
+      if (burnin_source >= 0) log_out << " (shared burn-in " << burnin_source << ")";
+      log_out << ":\n";
+      output::write_dol_to_console(log_out, dol);
+      result.log = log_out.str();
+
+      if (p.write_ant_output()) {
+        std::ostringstream ants_out;
+        if (p.ant_output_type == ant_output::summary) {
+          output::write_ants_summary(ants_out, colony, focal_ants, item.repl,
+                                     min_t, max_t);
+        } else {
+          output::write_ants(ants_out, colony, focal_ants, item.repl);
+        }
+        result.ants = ants_out.str();
+      }
+
+      if (p.data_interval == 0) {
+        std::ostringstream window_out;
+        output::write_dol_sliding_window(window_out,
+                                         colony,
+                                         p.window_size,
+                                         p.window_step_size,
+                                         static_cast<time_type>(p.simulation_time),
+                                         item.repl);
+        result.window = window_out.str();
+      }
+
+      if (p.data_interval > 0) {
+        std::ostringstream snapshot_out;
+        output::write_snapshots(snapshot_out,
+                                item.sim->snapshots,
+                                colony.size(),
+                                item.repl);
+        result.snapshots = snapshot_out.str();
+      }
+
+      if (p.hw_counters) {
+        std::ostringstream hw_out;
+        hw_out << "  hardware counters, simulation:";
+        perf::write(hw_out, item.hw_simulation);
+        hw_out << "\n  hardware counters, statistics:";
+        perf::write(hw_out, hw_statistics);
+        hw_out << "\n  hardware counters, output:";
+        perf::write(hw_out, hw_output.stop());
+        hw_out << "\n";
+        result.log += hw_out.str();
+      }
+
+#ifdef DOL_COUNTERS
+      item.times.output = std::chrono::duration<double>(std::chrono::steady_clock::now() - phase_start).count();
+      std::ostringstream counters_out;
+      counters::write(counters_out, item.repl, item.sim->event_counts(), item.times);
+      result.counters = counters_out.str();
+#endif
+
+      // release the colony before waiting on the writer
+      sims.release(std::move(item.sim));
+      if (!out.push(std::move(result))) return;
+    }
+  }
+
+  inline void write_stage(const params& p,
+                          bounded_queue<formatted_replicate>& in,
+                          write_window& window,
+                          output::sinks& files,
+                          aggregate::sweep_summary& summary,
+                          progress::run_metrics* metrics) {
+    // replicates finish out of order with more than one worker; they wait
+    // here until all earlier ones are written, so that the output files
+    // and the summary see them in replicate order
+    std::map<size_t, formatted_replicate> waiting;
+    size_t next_repl = 0;
+    formatted_replicate item;
+    while (in.pop(item)) {
+      std::cout << item.log;
+      const size_t repl = item.repl;
+      waiting.emplace(repl, std::move(item));
+      for (auto i = waiting.begin(); i != waiting.end() && i->first == next_repl;
+           i = waiting.erase(i), ++next_repl) {
+        trace::scope s("write replicate");
+        const auto& r = i->second;
+        summary.add(p, r.dol_values);
+        files.dol.write(r.dol);
+        files.ants.write(r.ants);
+        files.window.write(r.window);
+        files.snapshots.write(r.snapshots);
+        files.counters.write(r.counters);
+        files.flush();
+        if (metrics) metrics->replicates_finished.fetch_add(1, std::memory_order_relaxed);
+      }
+      window.written(next_repl);
+    }
+  }
+
+  // Runs all replicates of p as a three stage pipeline:
+  // num_sim_threads simulation workers -> num_analysis_threads analysis
+  // workers -> one writer thread, which owns no files itself but writes to
+  // the sinks created by the caller in replicate order, and adds the DoL
+  // metrics of each replicate to summary. At most queue_size replicates
+  // wait between two stages, and a replicate only starts when fewer than
+  // queue_size plus the number of simulation slots are ahead of the
+  // writer, which bounds memory use.
+  inline void run_replicates(const params& p,
+                             output::sinks& files,
+                             aggregate::sweep_summary& summary) {
+    bounded_queue<finished_replicate> finished(p.queue_size);
+    bounded_queue<formatted_replicate> formatted(p.queue_size);
+    error_state errors;
+    std::atomic<size_t> next_repl{0};
+    simulation_pool sims;
+
+    const size_t num_sim_threads = std::max<size_t>(p.num_sim_threads, 1);
+    const size_t batch_size = p.use_batch_engine() ? p.batch_size : 1;
+    // every simulation slot can be busy while queue_size replicates wait
+    write_window window(p.queue_size + num_sim_threads * batch_size);
+    std::unique_ptr< progress::run_metrics > metrics;
+    std::unique_ptr< progress::exporter > exporter;  // stops before metrics go
+    if (!p.metrics_file.empty()) {
+      metrics = std::make_unique< progress::run_metrics >(num_sim_threads, p.num_replicates,
+                                                          static_cast<double>(p.simulation_time));
+      exporter = std::make_unique< progress::exporter >(p.metrics_file, p.metrics_interval, *metrics);
+    }
+
+    const cpu::isa level = cpu::select(p.max_isa);
+    std::cout << "vector kernels: " << cpu::name(level) << " (cpu supports "
+              << cpu::name(cpu::supported()) << ")\n";
+
+    if (p.hw_counters && !perf::local_counters().error().empty()) {
+      std::cout << "hardware counters partly unavailable (" << perf::local_counters().error()
+                << "), these are reported as n/a\n";
+    }
+
+    std::vector< std::string > burnins;
+    if (p.shared_burnin > 0) {
+      auto clock_start = std::chrono::system_clock::now();
+      burnins = run_burnins(p);
+      std::chrono::duration<double> elapsed_seconds = std::chrono::system_clock::now() - clock_start;
+      std::cout << p.shared_burnin << " shared burn-in(s) up to t = "
+                << p.burnin * p.simulation_time << " took: "
+                << elapsed_seconds.count() << "seconds\n";
+    }
+
+    auto guarded = [&](auto&& stage) {
+      return [&, stage]() {
+        try {
+          stage();
+        } catch (...) {
+          errors.set(std::current_exception());
+          window.close();
+          finished.close();
+          formatted.close();
+        }
+      };
+    };
+
+    std::thread writer(guarded([&]() { write_stage(p, formatted, window, files, summary, metrics.get()); }));
+
+    std::vector<std::thread> analysts;
+    for (size_t i = 0; i < std::max<size_t>(p.num_analysis_threads, 1); ++i) {
+      analysts.emplace_back(guarded([&]() { analysis_stage(p, sims, finished, formatted); }));
+    }
+
+    std::vector<std::thread> simulators;
+    for (size_t i = 0; i < num_sim_threads; ++i) {
+      progress::slot* slot = metrics ? &metrics->slots[i] : nullptr;
+      simulators.emplace_back(guarded([&, slot]() { simulate_stage(p, burnins, sims, next_repl, window, finished, slot); }));
+    }
+
+    for (auto& i : simulators) i.join();
+    finished.close();
+    for (auto& i : analysts) i.join();
+    formatted.close();
+    writer.join();
+
+    if (errors.error) std::rethrow_exception(errors.error);
+  }
+}
+
+#endif /* pipeline_h */
@@ -0,0 +1,199 @@
+//
+//  progress.h
+//  dol_fatbody_tj
+//
+//  Live progress of a run in the Prometheus textfile format, for the
+//  textfile collector of a node exporter. The event loops publish their
+//  progress into relaxed atomics every publish_every events; a background
+//  thread at low priority turns these into a metrics file every
+//  metrics_interval seconds, written next to its final name and renamed,
+//  so that readers never see a partial file.
+//
+
+#ifndef progress_h
+#define progress_h
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace progress {
+
+  // events between two publications of an event loop
+  constexpr uint64_t publish_every = uint64_t{1} << 14;
+
+  // progress of the replicate(s) one simulation thread is working on
+  struct slot {
+    std::atomic<bool> running{false};
+    std::atomic<double> t{0.0};
+    std::atomic<uint64_t> events{0};         // over all replicates
+    std::atomic<uint64_t> history_bytes{0};
+
+    void publish(double now, uint64_t new_events, uint64_t bytes) {
+      t.store(now, std::memory_order_relaxed);
+      events.fetch_add(new_events, std::memory_order_relaxed);
+      history_bytes.store(bytes, std::memory_order_relaxed);
+    }
+  };
+
+  struct run_metrics {
+    run_metrics(size_t num_slots, size_t replicates, double sim_time) :
+      slots(new slot[num_slots]), num_slots(num_slots),
+      replicates_total(replicates), simulation_time(sim_time),
+      start(std::chrono::steady_clock::now()) {}
+
+    std::unique_ptr<slot[]> slots;
+    const size_t num_slots;
+    std::atomic<size_t> replicates_finished{0};
+    const size_t replicates_total;
+    const double simulation_time;
+    const std::chrono::steady_clock::time_point start;
+
+    uint64_t events() const {
+      uint64_t e = 0;
+      for (size_t i = 0; i < num_slots; ++i) e += slots[i].events.load(std::memory_order_relaxed);
+      return e;
+    }
+
+    // prometheus text format; events_per_second is measured by the caller
+    std::string format(double events_per_second) const {
+      const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      const size_t finished = replicates_finished.load(std::memory_order_relaxed);
+      double done = static_cast<double>(finished);
+      uint64_t history = 0;
+      std::ostringstream out;
+      out << "# HELP dol_simulated_time Simulated time of the replicate a simulation thread works on.\n"
+          << "# TYPE dol_simulated_time gauge\n";
+      for (size_t i = 0; i < num_slots; ++i) {
+        const auto& s = slots[i];
+        const double t = s.t.load(std::memory_order_relaxed);
+        out << "dol_simulated_time{thread=\"" << i << "\"} " << t << "\n";
+        if (s.running.load(std::memory_order_relaxed)) {
+          if (simulation_time > 0) done += std::min(1.0, t / simulation_time);
+          history += s.history_bytes.load(std::memory_order_relaxed);
+        }
+      }
+      done = std::min(done, static_cast<double>(replicates_total));
+      const double eta = done > 0 ? elapsed * (replicates_total - done) / done : -1.0;
+
+      out << "# HELP dol_simulation_time Simulated time at which a replicate ends.\n"
+          << "# TYPE dol_simulation_time gauge\n"
+          << "dol_simulation_time " << simulation_time << "\n"
+          << "# HELP dol_events_total Events processed.\n"
+          << "# TYPE dol_events_total counter\n"
+          << "dol_events_total " << events() << "\n"
+          << "# HELP dol_events_per_second Events processed per second since the previous update.\n"
+          << "# TYPE dol_events_per_second gauge\n"
+          << "dol_events_per_second " << events_per_second << "\n"
+          << "# HELP dol_replicates_finished Replicates written to file.\n"
+          << "# TYPE dol_replicates_finished gauge\n"
+          << "dol_replicates_finished " << finished << "\n"
+          << "# HELP dol_replicates_total Replicates of the run.\n"
+          << "# TYPE dol_replicates_total gauge\n"
+          << "dol_replicates_total " << replicates_total << "\n"
+          << "# HELP dol_history_bytes Memory held by the histories of running replicates.\n"
+          << "# TYPE dol_history_bytes gauge\n"
+          << "dol_history_bytes " << history << "\n"
+          << "# HELP dol_elapsed_seconds Wall time since the start of the run.\n"
+          << "# TYPE dol_elapsed_seconds gauge\n"
+          << "dol_elapsed_seconds " << elapsed << "\n"
+          << "# HELP dol_eta_seconds Estimated wall time until the run ends, -1 if unknown.\n"
+          << "# TYPE dol_eta_seconds gauge\n"
+          << "dol_eta_seconds " << eta << "\n";
+      return out.str();
+    }
+  };
+
+  // rewrites file_name from run_metrics every interval seconds, and once
+  // more when destroyed
+  class exporter {
+  public:
+    exporter(const std::string& file_name, double interval, const run_metrics& metrics) :
+      file_name_(file_name), interval_(interval), metrics_(metrics),
+      thread_([this]() { work(); }) {}
+
+    exporter(const exporter&) = delete;
+    exporter& operator=(const exporter&) = delete;
+
+    ~exporter() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      wake_.notify_one();
+      thread_.join();
+    }
+
+  private:
+    void work() {
+#ifdef __linux__
+      // lowest priority for this thread only, the simulation comes first
+      setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+#endif
+      auto last_time = std::chrono::steady_clock::now();
+      uint64_t last_events = metrics_.events();
+      const auto wait = std::chrono::duration<double>(interval_ > 0 ? interval_ : 1.0);
+      while (true) {
+        bool stop;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          wake_.wait_for(lock, wait, [this]() { return stop_; });
+          stop = stop_;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        const uint64_t events = metrics_.events();
+        const double dt = std::chrono::duration<double>(now - last_time).count();
+        const double rate = dt > 0 ? (events - last_events) / dt : 0.0;
+        last_time = now;
+        last_events = events;
+        try {
+          write_file(metrics_.format(rate));
+        } catch (const std::exception& e) {
+          // metrics are a side show, the run goes on without them
+          std::cerr << e.what() << "\n";
+        }
+        if (stop) return;
+      }
+    }
+
+    void write_file(const std::string& data) const {
+      const std::string temp_name = file_name_ + ".tmp";
+      {
+        std::ofstream out(temp_name.c_str(), std::ios::trunc);
+        out << data;
+        out.flush();
+        if (!out) throw std::runtime_error("failed writing to: " + temp_name);
+      }
+      if (std::rename(temp_name.c_str(), file_name_.c_str()) != 0) {
+        throw std::runtime_error("can't rename metrics file to: " + file_name_);
+      }
+    }
+
+    std::string file_name_;
+    double interval_;
+    const run_metrics& metrics_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+    std::thread thread_;  // last, starts after the other members exist
+  };
+}
+
+#endif /* progress_h */
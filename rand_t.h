@@ -4,15 +4,71 @@
 #include <chrono>
 #include <thread>
 #include <array>
+#include <cstdint>
+#include <type_traits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <istream>
+#include <ostream>
 
-struct rnd_t {
-  std::mt19937 rndgen;
+#include "counters.h"
 
-  rnd_t(ctype_ m, ctype_ s) {
+// 64 bit generator with a single word of state (Steele et al. 2014), used
+// for the per individual random streams, where a std::mt19937 per
+// individual would be too large.
+struct splitmix64 {
+  using result_type = uint64_t;
+  uint64_t state;
+
+  explicit splitmix64(uint64_t seed = 0) : state(seed) {}
+
+  template <typename SSEQ,
+            typename = typename std::enable_if<!std::is_convertible<SSEQ, uint64_t>::value &&
+                                               !std::is_same<SSEQ, splitmix64>::value>::type>
+  explicit splitmix64(SSEQ& sseq) {
+    std::array<uint32_t, 2> v;
+    sseq.generate(v.begin(), v.end());
+    state = (static_cast<uint64_t>(v[0]) << 32) | v[1];
+  }
+
+  static constexpr result_type min() {return 0;}
+  static constexpr result_type max() {return ~uint64_t{0};}
+
+  result_type operator()() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  bool operator==(const splitmix64& other) const {return state == other.state;}
+
+  friend std::ostream& operator<<(std::ostream& os, const splitmix64& e) {
+    return os << e.state;
+  }
+  friend std::istream& operator>>(std::istream& is, splitmix64& e) {
+    return is >> e.state;
+  }
+};
+
+template <typename ENGINE>
+struct rnd_base {
+  ENGINE rndgen;
+
+  rnd_base(ctype_ m, ctype_ s) {
     const auto seed_array = make_seed_array();
     std::seed_seq sseq(seed_array.cbegin(), seed_array.cend());
 
-    rndgen = std::mt19937(sseq);
+    rndgen = ENGINE(sseq);
+    set_threshold_dist(m, s);
+  }
+
+  // reproducible stream
+  rnd_base(ctype_ m, ctype_ s, uint64_t seed) {
+    std::seed_seq sseq{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)};
+
+    rndgen = ENGINE(sseq);
     set_threshold_dist(m, s);
   }
 
@@ -55,7 +111,10 @@ struct rnd_t {
 
   ctype_ threshold_normal() {
     ctype_ output = threshold_dist(rndgen);
-    while(output < 0) output = threshold_dist(rndgen);
+    while(output < 0) {
+      output = threshold_dist(rndgen);
+      DOL_COUNT(threshold_rejections++);
+    }
     return output;
   }
 
@@ -63,11 +122,32 @@ struct rnd_t {
     threshold_dist = std::normal_distribution<ctype_>(static_cast<ctype_>(m), static_cast<ctype_>(s));
   }
 
+  // complete state of the stream, including the normal value the
+  // distribution keeps in reserve, in the textual form of the standard
+  std::string get_state() const {
+    std::ostringstream out;
+    out << rndgen << " " << threshold_dist << " " << unif_dist;
+    return out.str();
+  }
+
+  void set_state(const std::string& state) {
+    std::istringstream in(state);
+    in >> rndgen >> threshold_dist >> unif_dist;
+    if (!in) throw std::runtime_error("invalid random number state");
+  }
+
+#ifdef DOL_COUNTERS
+  uint64_t threshold_rejections = 0;
+#endif
+
 private:
-  std::normal_distribution<float> threshold_dist;
-  std::uniform_real_distribution<ctype_> unif_dist = std::uniform_real_distribution<ctype_>(ctype_(0), 
+  std::normal_distribution<ctype_> threshold_dist;
+  std::uniform_real_distribution<ctype_> unif_dist = std::uniform_real_distribution<ctype_>(ctype_(0),
                                                                                       ctype_(1));
 };
 
+using rnd_t = rnd_base< std::mt19937 >;
+using ant_rnd_t = rnd_base< splitmix64 >;  // per individual stream
+
 
 #endif /* rand_t.h */
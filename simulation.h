@@ -15,10 +15,23 @@
 #include <cassert>
 #include <algorithm>
 #include <limits>
+#include <functional>
+#include <memory>
+#include <cmath>
+#include <stdexcept>
+#include <sstream>
+#include <fstream>
+#include <string>
 
 #include "individual.h"
 #include "parameters.h"
 #include "rand_t.h"
+#include "worker_pool.h"
+#include "next_event.h"
+#include "checkpoint.h"
+#include "counters.h"
+#include "trace.h"
+#include "progress.h"
 
 #include <set>
 
@@ -28,26 +41,127 @@ struct Simulation {
 
   params p;
   rnd_t rndgen;
+  // one random stream per individual, so that the outcome does not depend
+  // on the order in which individuals are updated. Only used when
+  // p.per_ant_rng is set, or when the colony is updated in parallel.
+  std::vector< ant_rnd_t > ant_rng;
 
-  ctype_ t;
+  time_type t;
   int previous_time_recording;
 
+  // next event times in a dense array, used with scheduler = simd
+  next_event::simd_selector< time_type > selector;
+
+  // integer clock and event queue, used with scheduler = radix. A key holds
+  // the tick of the next event in the high bits and the index of the
+  // individual in the low bits, so that equal ticks go to the lowest index.
+  next_event::radix_heap< size_t > event_queue;
+  // keys below event_queue.last_key(): events at the current tick of
+  // individuals with a lower index than the last one processed. They come
+  // before everything in event_queue, lowest index first.
+  std::priority_queue< uint64_t, std::vector< uint64_t >, std::greater< uint64_t > > late_keys;
+  std::vector< uint64_t > event_key;  // current key per individual, others are stale
+  uint64_t tick;
+  size_t index_bits;
+
+  // colony snapshots, taken every data_interval time units when
+  // data_interval > 0. Stored per snapshot, and within a snapshot per ant.
+  std::vector< data_storage > snapshots;
+  time_type next_snapshot_t;
+
+  time_type next_checkpoint_t;  // used when checkpoints are enabled
+
+  // where run() publishes its progress, if set
+  progress::slot* progress_slot = nullptr;
+  uint64_t unpublished_events = 0;
+
   Simulation(const params& par,
-             std::vector<ctype_> (*share_func_grouped)(individual*, std::vector<individual*>, ctype_, size_t)) :
+             std::vector<ctype_> (*share_func_grouped)(individual*, std::vector<individual*>, time_type, ctype_, size_t)) :
              p(par),
-             rndgen(p.mean_threshold, p.sd_threshold) {
+             rndgen(p.seed == 0 ? rnd_t(p.mean_threshold, p.sd_threshold) :
+                                  rnd_t(p.mean_threshold, p.sd_threshold, p.seed)),
+             share_func(share_func_grouped) {
   
      colony = std::vector< individual >(p.colony_size);
-     for (auto& i : colony) {
-       i.initialize(p, rndgen, share_func_grouped);
+     init_colony();
+     if (p.num_colony_threads > 1 && p.foraging_time > 0) {
+       pool = std::make_unique< worker_pool >(p.num_colony_threads);
+       chunks.resize(pool->num_threads());
      }
-     t = 0.0;
-     previous_time_recording = -1;
   }
 
-  void update_colony() {
+  // starts a new replicate with the given seed (0: seed from the clock).
+  // The result is identical to a new Simulation, but the colony, the
+  // histories and the snapshots keep the memory of the previous run.
+  void reset(size_t seed) {
+    p.seed = seed;
+    rndgen = p.seed == 0 ? rnd_t(p.mean_threshold, p.sd_threshold) :
+                           rnd_t(p.mean_threshold, p.sd_threshold, p.seed);
+    checkpoint_writer.reset();
+    init_colony();
+  }
 
-    nurses.clear();
+  // replaces the random streams, used to branch replicates off a shared
+  // burn-in. A seed of 0 seeds from the clock, as in the constructor.
+  void reseed(uint64_t seed) {
+    rndgen = seed == 0 ? rnd_t(p.mean_threshold, p.sd_threshold) :
+                         rnd_t(p.mean_threshold, p.sd_threshold, seed);
+    for (auto& i : ant_rng) {
+      uint64_t ant_seed = (static_cast<uint64_t>(rndgen.rndgen()) << 32) | rndgen.rndgen();
+      i = ant_rnd_t(p.mean_threshold, p.sd_threshold, ant_seed);
+    }
+  }
+
+  // time of the next event of the colony
+  time_type next_event_time() {
+    if (p.scheduler == scheduler_type::radix) {
+      return static_cast<time_type>((next_key() >> index_bits) * p.time_resolution);
+    }
+    return find_next_individual()->get_next_t();
+  }
+
+  // processes all events before time end, one at a time, and moves the
+  // clock and the snapshots up to end. The histories stay open: fat bodies
+  // at end are evaluated on demand (colony_observer), and run() continues
+  // from here and does the final roll call.
+  void run_until(time_type end) {
+    end = std::min(end, static_cast<time_type>(p.simulation_time));
+    while (next_event_time() < end) {
+      update_colony();
+    }
+    if (end > t) {
+      take_snapshots(end);
+      t = end;
+    }
+  }
+
+  // record the state of all ants at the next snapshot time
+  void record_snapshot() {
+    for (const auto& i : colony) {
+      snapshots.push_back(data_storage(next_snapshot_t,
+                                       i.get_task(),
+                                       i.get_fat_body_at(next_snapshot_t)));
+    }
+    next_snapshot_t += p.data_interval;
+  }
+
+  // record the state of all ants at every snapshot time before new_t
+  void take_snapshots(time_type new_t) {
+    if (p.data_interval <= 0) return;
+    while (next_snapshot_t < new_t &&
+           next_snapshot_t <= p.simulation_time) {
+      record_snapshot();
+    }
+  }
+
+  // first individual with the earliest next event
+  std::vector< individual >::iterator find_next_individual() {
+    if (p.scheduler == scheduler_type::simd) {
+      return colony.begin() + static_cast<std::ptrdiff_t>(selector.argmin());
+    }
+    if (p.scheduler == scheduler_type::radix) {
+      return colony.begin() + static_cast<std::ptrdiff_t>(key_index(next_key()));
+    }
 
     auto focal_individual = colony.begin();
 
@@ -56,34 +170,482 @@ struct Simulation {
          focal_individual = i;
       }
     }
+    return focal_individual;
+  }
 
-    if (focal_individual->get_task() == task::forage) {
-        for (auto i = colony.begin(); i != colony.end(); ++i) {
-          if (i->get_task() == task::nurse) {
-            nurses.push_back(&(*i));
-          }
-        }
+  // after an event, the focal individual and the nurses it fed have a new
+  // next event time
+  void reschedule(size_t focal_index) {
+    if (p.scheduler == scheduler_type::scan) return;
+    if (p.scheduler == scheduler_type::radix) {
+      if (!late_keys.empty()) {
+        late_keys.pop();
+      } else {
+        event_queue.pop();
+      }
+      event_key[focal_index] = std::numeric_limits<uint64_t>::max();
+    }
+    schedule(focal_index);
+    for (size_t i = 0; i < num_fed(); ++i) {
+      schedule(static_cast<size_t>(nurses[i] - colony.data()));
     }
-    t = focal_individual->get_next_t();
+  }
+
+  void schedule(size_t index) {
+    if (p.scheduler == scheduler_type::simd) {
+      selector.set(index, colony[index].get_next_t());
+      return;
+    }
+    // round up, so that an event never happens before its time. Events
+    // beyond the last tick are never reached and share the last tick.
+    const uint64_t max_tick = std::numeric_limits<uint64_t>::max() >> index_bits;
+    const double next_tick = std::ceil(colony[index].get_next_t() / p.time_resolution);
+    uint64_t key = next_tick < static_cast<double>(max_tick) ? static_cast<uint64_t>(next_tick) : max_tick;
+    // an event before the current tick happens at the current tick
+    key = std::max(key, event_queue.last_key() >> index_bits);
+    key = (key << index_bits) | index;
+    if (key == event_key[index]) return;
+    event_key[index] = key;
+    push_key(key, index);
+  }
+
+  size_t key_index(uint64_t key) const {
+    return static_cast<size_t>(key & ((uint64_t{1} << index_bits) - 1));
+  }
+
+  void push_key(uint64_t key, size_t index) {
+    if (key < event_queue.last_key()) {
+      late_keys.push(key);
+    } else {
+      event_queue.push(key, index);
+    }
+  }
+
+  // smallest current key, drops stale entries on the way
+  uint64_t next_key() {
+    while (!late_keys.empty()) {
+      const uint64_t key = late_keys.top();
+      if (event_key[key_index(key)] == key) return key;
+      late_keys.pop();
+    }
+    while (event_key[event_queue.top().second] != event_queue.top().first) {
+      event_queue.pop();
+    }
+    return event_queue.top().first;
+  }
+
+  void init_event_queue() {
+    index_bits = 0;
+    while ((size_t{1} << index_bits) < colony.size()) index_bits++;
+    if (p.simulation_time / p.time_resolution >=
+        static_cast<double>(std::numeric_limits<uint64_t>::max() >> index_bits)) {
+      throw std::runtime_error("time_resolution too small for simulation_time and colony_size");
+    }
+    event_queue.clear();
+    late_keys = decltype(late_keys)();
+    event_key.assign(colony.size(), std::numeric_limits<uint64_t>::max());
+    for (size_t i = 0; i < colony.size(); ++i) {
+      schedule(i);
+    }
+  }
+
+  void update_colony() {
+
+    auto focal_individual = find_next_individual();
+
+    if (p.scheduler == scheduler_type::radix) {
+      tick = next_key() >> index_bits;
+      t = static_cast<time_type>(tick * p.time_resolution);
+    } else {
+      t = focal_individual->get_next_t();
+    }
+    take_snapshots(t);
     if (t > p.simulation_time) return;
 
-    focal_individual->update(t, p, rndgen, nurses);
+    update_individual(static_cast<size_t>(focal_individual - colony.begin()));
+  }
+
+  // the event of individual index at time t. A returning forager shares
+  // with the nurses of the colony.
+  void update_individual(size_t index) {
+    nurses.clear();
+    if (colony[index].get_task() == task::forage) {
+      for (auto i = colony.begin(); i != colony.end(); ++i) {
+        if (i->get_task() == task::nurse) {
+          nurses.push_back(&(*i));
+        }
+      }
+    }
+
+    if (ant_rng.empty()) {
+      colony[index].update(t, p, rndgen, nurses);
+    } else {
+      colony[index].update(t, p, ant_rng[index], nurses);
+    }
+    reschedule(index);
+  }
+
+  // nurses that can have been fed at the last event, the first ones in nurses
+  size_t num_fed() const {
+    return std::min(p.max_number_interactions, nurses.size());
   }
 
   void run() {
-    while(t < p.simulation_time) {
-      update_colony();
+    trace::scope s("Simulation::run");
+    if (pool) {
+      run_parallel();
+    } else {
+      while(t < p.simulation_time) {
+        update_colony();
+        checkpoint_if_due();
+        if (progress_slot && ++unpublished_events == progress::publish_every) {
+          publish_progress();
+        }
+      }
+    }
+    if (checkpoint_writer) {
+      // resuming from here only repeats the end of the run
+      save_checkpoint();
+      checkpoint_writer->wait();
     }
+    finish();
+    if (progress_slot) publish_progress();
+  }
+
+  // end roll call, for data purposes
+  void finish() {
     t = p.simulation_time;
-    // end roll call, for data purposes:
+    take_snapshots(std::numeric_limits<time_type>::max());
     for (auto& i : colony) {
       i.update_fatbody(t);
       i.update_data(t);
     }
   }
+
+  // Conservative parallel engine. Forager returns are the only events that
+  // change other individuals. All other events before the next forager
+  // return change only the focal individual and are processed concurrently,
+  // after which the forager return itself is processed serially. New
+  // foragers cannot return before t + foraging_time, which bounds each
+  // window as well. Because every individual draws from its own random
+  // stream, the result is identical to update_colony() with per_ant_rng.
+  void run_parallel() {
+    process_window(t, 0); // only collects the next forager return
+    while (true) {
+      checkpoint_if_due();
+      time_type limit = t + p.foraging_time;
+      size_t tie_index = 0;
+      bool forager_next = false;
+      bool snapshot_next = false;
+      if (forager_t <= limit) {
+        limit = forager_t;
+        tie_index = forager_index; // equal times: lowest index goes first
+        forager_next = true;
+      }
+      if (p.data_interval > 0 && next_snapshot_t <= p.simulation_time &&
+          next_snapshot_t < limit) {
+        limit = next_snapshot_t;
+        tie_index = colony.size();
+        forager_next = false;
+        snapshot_next = true;
+      }
+      if (limit > p.simulation_time) {
+        process_window(static_cast<time_type>(p.simulation_time), colony.size());
+        return;
+      }
+
+      process_window(limit, tie_index);
+      t = limit;
+
+      if (snapshot_next) record_snapshot();
+
+      if (progress_slot) {
+        for (auto& c : chunks) unpublished_events += c.events;
+        if (forager_next) unpublished_events++;
+        if (unpublished_events >= progress::publish_every) publish_progress();
+      }
+
+      if (forager_next) {
+        nurses.clear();
+        for (const auto& c : chunks) {
+          nurses.insert(nurses.end(), c.nurses.begin(), c.nurses.end());
+        }
+        size_t focal = forager_index;
+        colony[focal].update(t, p, ant_rng[focal], nurses);
+        // only the chunk of the forager can have a new next forager return:
+        // nurses that received food are handling food now.
+        refresh_forager(focal / chunk_size());
+      }
+    }
+  }
+
+  void publish_progress() {
+    progress_slot->publish(static_cast<double>(t), unpublished_events, history_bytes());
+    unpublished_events = 0;
+  }
+
+  // memory held by the histories and snapshots
+  size_t history_bytes() const {
+    size_t bytes = snapshots.capacity() * sizeof(data_storage);
+    for (const auto& i : colony) {
+      bytes += i.get_data().capacity() * sizeof(data_storage);
+    }
+    return bytes;
+  }
+
+  // checkpoints of this simulation are written to file_name by a background
+  // thread, every p.checkpoint_interval time units and at the end of run()
+  void enable_checkpoints(const std::string& file_name) {
+    checkpoint_writer = std::make_unique< checkpoint::writer >(file_name);
+  }
+
+  void save_checkpoint() {
+    std::ostringstream out(std::ios::binary);
+    save_state(out);
+    checkpoint_writer->submit(out.str());
+  }
+
+  void checkpoint_if_due() {
+    if (!checkpoint_writer || p.checkpoint_interval <= 0 || t < next_checkpoint_t) return;
+    while (next_checkpoint_t <= t) next_checkpoint_t += p.checkpoint_interval;
+    save_checkpoint();
+  }
+
+  void load_checkpoint(const std::string& file_name) {
+    std::ifstream in(file_name, std::ios::binary);
+    if (!in.is_open()) {
+      throw std::runtime_error("can't open checkpoint: " + file_name);
+    }
+    load_state(in, true);
+  }
+
+  // Everything needed to continue the run bit-identically. The parameters
+  // themselves come from the config file; a hash of them and the seed are
+  // recorded and checked, together with the sizes of the stored state.
+  void save_state(std::ostream& out) const {
+    checkpoint::write_string(out, checkpoint_tag);
+    checkpoint::write<uint32_t>(out, sizeof(ctype_));
+    checkpoint::write<uint32_t>(out, sizeof(time_type));
+    checkpoint::write<uint64_t>(out, checkpoint::params_hash(p));
+    checkpoint::write<uint64_t>(out, p.seed);
+    checkpoint::write<uint64_t>(out, colony.size());
+    checkpoint::write(out, p.model_type);
+    checkpoint::write(out, p.scheduler);
+    checkpoint::write(out, p.data_interval);
+    checkpoint::write<uint64_t>(out, ant_rng.size());
+
+    checkpoint::write(out, t);
+    checkpoint::write(out, previous_time_recording);
+    checkpoint::write(out, next_snapshot_t);
+    checkpoint::write(out, next_checkpoint_t);
+    checkpoint::write(out, tick);
+
+    checkpoint::write_string(out, rndgen.get_state());
+    for (const auto& i : ant_rng) checkpoint::write_string(out, i.get_state());
+    for (const auto& i : colony) i.save(out);
+
+    checkpoint::write<uint64_t>(out, snapshots.size());
+    for (const auto& i : snapshots) {
+      checkpoint::write(out, i.t_);
+      checkpoint::write(out, i.current_task_);
+      checkpoint::write(out, i.fb_);
+    }
+
+    if (p.scheduler == scheduler_type::radix) {
+      checkpoint::write(out, event_queue.last_key());
+      for (auto i : event_key) checkpoint::write(out, i);
+    }
+  }
+
+  // A branch off a shared burn-in continues with its own seed, a resumed
+  // replicate only with the seed it was started with (check_seed).
+  void load_state(std::istream& in, bool check_seed = false) {
+    if (checkpoint::read_string(in) != checkpoint_tag ||
+        checkpoint::read<uint32_t>(in) != sizeof(ctype_) ||
+        checkpoint::read<uint32_t>(in) != sizeof(time_type)) {
+      throw std::runtime_error("not a checkpoint of this build");
+    }
+    const auto hash = checkpoint::read<uint64_t>(in);
+    const auto seed = checkpoint::read<uint64_t>(in);
+    if (hash != checkpoint::params_hash(p) || (check_seed && seed != p.seed)) {
+      throw std::runtime_error("checkpoint was written with other parameters");
+    }
+    if (checkpoint::read<uint64_t>(in) != colony.size() ||
+        checkpoint::read<share_model>(in) != p.model_type ||
+        checkpoint::read<scheduler_type>(in) != p.scheduler ||
+        checkpoint::read<int>(in) != p.data_interval ||
+        checkpoint::read<uint64_t>(in) != ant_rng.size()) {
+      throw std::runtime_error("checkpoint does not match the parameters");
+    }
+
+    t                       = checkpoint::read<time_type>(in);
+    previous_time_recording = checkpoint::read<int>(in);
+    next_snapshot_t         = checkpoint::read<time_type>(in);
+    next_checkpoint_t       = checkpoint::read<time_type>(in);
+    tick                    = checkpoint::read<uint64_t>(in);
+
+    rndgen.set_state(checkpoint::read_string(in));
+    for (auto& i : ant_rng) i.set_state(checkpoint::read_string(in));
+    for (auto& i : colony) i.load(in);
+
+    const auto num_snapshots = checkpoint::read<uint64_t>(in);
+    snapshots.clear();
+    snapshots.reserve(num_snapshots);
+    for (size_t i = 0; i < num_snapshots; ++i) {
+      auto st = checkpoint::read<time_type>(in);
+      auto ct = checkpoint::read<task>(in);
+      auto fb = checkpoint::read<ctype_>(in);
+      snapshots.push_back(data_storage(st, ct, fb));
+    }
+
+    if (p.scheduler == scheduler_type::simd) {
+      for (size_t i = 0; i < colony.size(); ++i) schedule(i);
+    }
+    if (p.scheduler == scheduler_type::radix) {
+      event_queue.clear(checkpoint::read<uint64_t>(in));
+      late_keys = decltype(late_keys)();
+      for (size_t i = 0; i < colony.size(); ++i) {
+        event_key[i] = checkpoint::read<uint64_t>(in);
+        push_key(event_key[i], i);
+      }
+    }
+  }
+
+#ifdef DOL_COUNTERS
+  // events since the start of the replicate, over the colony and the
+  // random streams
+  counters::event_counts event_counts() const {
+    counters::event_counts c;
+    for (const auto& i : colony) c.add(i.get_counts());
+    c.threshold_rejections += rndgen.threshold_rejections;
+    for (const auto& i : ant_rng) c.threshold_rejections += i.threshold_rejections;
+    return c;
+  }
+#endif
+
+private:
+  std::vector<ctype_> (*share_func)(individual*, std::vector<individual*>, time_type, ctype_, size_t);
+
+  void init_colony() {
+    if (p.per_ant_rng || p.num_colony_threads > 1) {
+      ant_rng.clear();
+      ant_rng.reserve(p.colony_size);
+      for (size_t i = 0; i < colony.size(); ++i) {
+        uint64_t seed = (static_cast<uint64_t>(rndgen.rndgen()) << 32) | rndgen.rndgen();
+        ant_rng.emplace_back(p.mean_threshold, p.sd_threshold, seed);
+        colony[i].initialize(p, ant_rng[i], share_func);
+      }
+    } else {
+      for (auto& i : colony) {
+        i.initialize(p, rndgen, share_func);
+      }
+    }
+    t = 0.0;
+    previous_time_recording = -1;
+    next_snapshot_t = 0.0;
+    next_checkpoint_t = p.checkpoint_interval;
+    snapshots.clear();
+    if (p.data_interval > 0) {
+      snapshots.reserve(p.colony_size * (p.simulation_time / static_cast<size_t>(p.data_interval) + 1));
+    }
+    tick = 0;
+    index_bits = 0;
+    if (p.scheduler == scheduler_type::simd) {
+      selector.resize(colony.size());
+      for (size_t i = 0; i < colony.size(); ++i) {
+        schedule(i);
+      }
+    }
+    if (p.scheduler == scheduler_type::radix) {
+      init_event_queue();
+    }
+  }
+
+  static constexpr const char* checkpoint_tag = "dol_fatbody checkpoint 2";
+
+  std::unique_ptr< checkpoint::writer > checkpoint_writer;
+
+  struct chunk_state {
+    time_type forager_t;
+    size_t forager_index;
+    std::vector< individual* > nurses;
+    std::vector< individual* > no_nurses;  // passed to non-foragers
+    size_t events = 0;  // processed in the last window
+  };
+
+  std::unique_ptr< worker_pool > pool;
+  std::vector< chunk_state > chunks;
+  time_type forager_t = std::numeric_limits<time_type>::max();
+  size_t forager_index = 0;
+
+  size_t chunk_size() const {
+    return (colony.size() + chunks.size() - 1) / chunks.size();
+  }
+
+  // processes, per chunk of individuals, all events that are not forager
+  // returns and happen before limit (or at limit, for individuals with an
+  // index below tie_index). Afterwards, collects the next forager return
+  // and the current nurses.
+  void process_window(time_type limit, size_t tie_index) {
+    const size_t size = chunk_size();
+    std::function<void(size_t)> f = [&](size_t c) {
+      auto& state = chunks[c];
+      state.nurses.clear();
+      state.forager_t = std::numeric_limits<time_type>::max();
+      state.forager_index = colony.size();
+      state.events = 0;
+      const size_t end = std::min(colony.size(), (c + 1) * size);
+      for (size_t i = c * size; i < end; ++i) {
+        auto& ind = colony[i];
+        while (ind.get_task() != task::forage &&
+               (ind.get_next_t() < limit ||
+                (ind.get_next_t() == limit && i < tie_index))) {
+          ind.update(ind.get_next_t(), p, ant_rng[i], state.no_nurses);
+          state.events++;
+        }
+        if (ind.get_task() == task::forage) {
+          if (ind.get_next_t() < state.forager_t) {
+            state.forager_t = ind.get_next_t();
+            state.forager_index = i;
+          }
+        } else if (ind.get_task() == task::nurse) {
+          state.nurses.push_back(&ind);
+        }
+      }
+    };
+    pool->run(chunks.size(), f);
+    reduce_foragers();
+  }
+
+  void refresh_forager(size_t c) {
+    auto& state = chunks[c];
+    state.forager_t = std::numeric_limits<time_type>::max();
+    state.forager_index = colony.size();
+    const size_t size = chunk_size();
+    const size_t end = std::min(colony.size(), (c + 1) * size);
+    for (size_t i = c * size; i < end; ++i) {
+      if (colony[i].get_task() == task::forage &&
+          colony[i].get_next_t() < state.forager_t) {
+        state.forager_t = colony[i].get_next_t();
+        state.forager_index = i;
+      }
+    }
+    reduce_foragers();
+  }
+
+  void reduce_foragers() {
+    forager_t = std::numeric_limits<time_type>::max();
+    forager_index = colony.size();
+    for (const auto& c : chunks) {
+      if (c.forager_t < forager_t) {
+        forager_t = c.forager_t;
+        forager_index = c.forager_index;
+      }
+    }
+  }
 };
 
-std::unique_ptr<Simulation> create_simulation(const params& p) {
+inline std::unique_ptr<Simulation> create_simulation(const params& p) {
 
   switch(p.model_type) {
     case share_model::no : {
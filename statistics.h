@@ -10,11 +10,18 @@
 #define statistics_h
 
 #include <numeric>
+#include <algorithm>
+#include <limits>
+#include <ostream>
+#include <tuple>
+
+#include "cpu_dispatch.h"
+#include "trace.h"
 
 namespace stats {
 
-  double calc_freq_switches(const individual& indiv,
-                            ctype_ min_t, ctype_ max_t) {
+  inline double calc_freq_switches(const individual& indiv,
+                                   time_type min_t, time_type max_t) {
     if (indiv.get_data().size() <= 1) {
       return 0.0;
     }
@@ -23,8 +30,8 @@ namespace stats {
     size_t checked_time_points = 0;
     for (size_t i = 1; i < indiv.get_data().size(); ++i) {
 
-      ctype_ t1 = indiv.get_data()[i - 1].t_;
-      ctype_ t2 = indiv.get_data()[i].t_;
+      time_type t1 = indiv.get_data()[i - 1].t_;
+      time_type t2 = indiv.get_data()[i].t_;
       if (t1 >= min_t && t2 <= max_t) {
         checked_time_points++;
         auto task1 = indiv.get_data()[i].current_task_;
@@ -39,8 +46,8 @@ namespace stats {
     return cnt * 1.0 / checked_time_points;;
   }
 
-  size_t count_p(const individual& indiv, ctype_ min_t, ctype_ max_t,
-                 size_t& num_switches)  {
+  inline size_t count_p(const individual& indiv, time_type min_t, time_type max_t,
+                        size_t& num_switches)  {
     if (indiv.get_data().size() <= 1) {
       num_switches += 1;
       return 0;
@@ -48,7 +55,7 @@ namespace stats {
 
     size_t cnt = 0;
     for (const auto& i : indiv.get_data()) {
-      ctype_ t = i.t_;
+      time_type t = i.t_;
       if (t >= min_t && t <= max_t) {
         if (i.current_task_ == task::nurse) cnt++;
         num_switches++;
@@ -57,21 +64,21 @@ namespace stats {
     return cnt;
   }
 
-  std::vector<ctype_> calculate_task_frequency(const individual& indiv,
-                                               ctype_ min_t, ctype_ max_t)  {
-    std::vector<ctype_> task_freq(2, 0.0);
+  inline std::vector<stat_type> calculate_task_frequency(const individual& indiv,
+                                                         time_type min_t, time_type max_t)  {
+    std::vector<stat_type> task_freq(2, 0.0);
 
     for (size_t i = 0; i < indiv.get_data().size(); ++i) {
 
-      ctype_ start_t = indiv.get_data()[i].t_;
-      ctype_ end_t = max_t;
+      time_type start_t = indiv.get_data()[i].t_;
+      time_type end_t = max_t;
       if (i + 1 < indiv.get_data().size()) {
         end_t = indiv.get_data()[i + 1].t_;
       }
 
       if (start_t >= min_t && end_t <= max_t &&
           start_t <= max_t && end_t >= min_t) {
-        ctype_ dt = end_t - start_t;
+        stat_type dt = end_t - start_t;
         int index = static_cast<int>(indiv.get_data()[i].current_task_);
         assert(dt >= 0.f);
         task_freq[ index ] += dt;
@@ -80,8 +87,9 @@ namespace stats {
     return task_freq;
   }
 
-  double calculate_gautrais(const std::vector< individual>& colony,
-                            ctype_ min_t, ctype_ max_t) {
+  inline double calculate_gautrais(const std::vector< individual>& colony,
+                                   time_type min_t, time_type max_t) {
+    trace::scope s("stats::calculate_gautrais");
     std::vector<double> f_values(colony.size());
     int cnt = 0;
     for (const auto& i : colony) {
@@ -93,8 +101,9 @@ namespace stats {
                    1.0 / f_values.size();
   }
 
-  double calculate_duarte(const std::vector< individual>& colony,
-                          ctype_ min_t, ctype_ max_t) {
+  inline double calculate_duarte(const std::vector< individual>& colony,
+                                 time_type min_t, time_type max_t) {
+    trace::scope s("stats::calculate_duarte");
     std::vector<double> q(colony.size());
     std::vector<size_t> p(colony.size());
     size_t cnt = 0;
@@ -115,21 +124,54 @@ namespace stats {
     return q_bar / (p1 * p1 + p2 * p2) - 1;
   }
 
-  std::tuple<double, double, double> calculate_gorelick(const std::vector< individual>& colony,
-                                                        ctype_ min_t, ctype_ max_t) {
+  // sum of p log p over p > 0
+  inline double sum_p_log_p(const std::vector<double>& p) {
+    const double* x = p.data();
+    const size_t n = p.size();
+    return cpu::dispatch([&]() {
+      double s = 0.0;
+      for (size_t i = 0; i < n; ++i) {
+        if (x[i] > 0) s += x[i] * log(x[i]);
+      }
+      return s;
+    });
+  }
+
+  // sum of x log(x / (p_task p_ind)) over x > 0, the part of the mutual
+  // information that comes from one task
+  inline double sum_mutual_information(const std::vector<double>& m_task,
+                                       const std::vector<double>& p_ind,
+                                       double p_task) {
+    const double* x = m_task.data();
+    const double* p = p_ind.data();
+    const size_t n = m_task.size();
+    return cpu::dispatch([&]() {
+      double s = 0.0;
+      for (size_t i = 0; i < n; ++i) {
+        if (x[i] > 0) s += x[i] * log(x[i] / (p_task * p[i]));
+      }
+      return s;
+    });
+  }
+
+  inline std::tuple<double, double, double> calculate_gorelick(const std::vector< individual>& colony,
+                                                               time_type min_t, time_type max_t) {
+    trace::scope s("stats::calculate_gorelick");
     // HARDCODED 2 TASKS !!!
-    std::vector<std::vector<ctype_>> m(colony.size(), std::vector<ctype_>(2, 0.0));
+    std::vector<std::vector<stat_type>> m(colony.size(), std::vector<stat_type>(2, 0.0));
     // calculate frequency per individual per task
-    ctype_ sum = 0.0;
+    stat_type sum = 0.0;
     for (size_t i = 0; i < colony.size(); ++i) {
       m[i] = calculate_task_frequency(colony[i], min_t, max_t);
       sum += (m[i][0] + m[i][1]);
     }
 
-    ctype_ mult = static_cast<ctype_>(1.0) / sum;
+    stat_type mult = static_cast<stat_type>(1.0) / sum;
 
     std::vector<double> pTask(2, 0.0);
     std::vector<double> pInd(m.size(), 0.0);
+    // m per task, contiguous over individuals
+    std::vector<std::vector<double>> mTask(2, std::vector<double>(m.size(), 0.0));
 
     for(size_t i = 0; i < m.size(); ++i) {
       for (size_t j = 0; j < 2; ++j) {
@@ -137,38 +179,20 @@ namespace stats {
 
         pTask[j] += static_cast<double>(m[i][j]);
         pInd[i]  += static_cast<double>(m[i][j]);
+        mTask[j][i] = static_cast<double>(m[i][j]);
       }
     }
 
     // calculate Hy, marginal entropy
-     double Hy = 0;
-     for (size_t i = 0; i < pTask.size(); ++i) {
-       if (pTask[i] != 0.0) {
-           Hy += pTask[i] * log(pTask[i]);
-       }
-     }
-
-     Hy *= -1;
-
-    // Calculate marginal entropy for individuals
-    double Hx = 0.0;
-    for (size_t i = 0; i < pInd.size(); ++i) {
-           if (pInd[i] > 0) {
-               Hx += pInd[i] * log(pInd[i]); // Again, this is Shannon's equation, but not yet mulpiplied by -1...
-           }
-    }
-    Hx *= -1; // ...and here, again, multiplied by -1
+     double Hy = -sum_p_log_p(pTask);
+
+    // Calculate marginal entropy for individuals, Shannon's equation again
+    double Hx = -sum_p_log_p(pInd);
 
    // calculate Ixy, mutual entropy
    double Ixy = 0;
-   for (size_t i = 0; i < m[0].size(); ++i) {
-     for (size_t j = 0; j < m.size(); ++j) {
-
-       auto x = m[j][i];
-       if (x != 0) {
-        Ixy += x * log(x / (pTask[i] * pInd[j]));
-       }
-     }
+   for (size_t i = 0; i < mTask.size(); ++i) {
+     Ixy += sum_mutual_information(mTask[i], pInd, pTask[i]);
    }
 
     double div_into_tasks = Ixy / Hy;  // in the original paper, Hx is reversed with Hy, but
@@ -177,125 +201,174 @@ namespace stats {
     double sim_div = Ixy / (sqrt(Hy * Hx));
     return std::make_tuple(div_into_tasks, div_into_indivs, sim_div);
   }
-}
 
-namespace output {
+  // per individual summary of the trajectory within [min_t, max_t]
+  struct ant_summary {
+    double nurse_share = 0.0;   // fraction of time spent nursing
+    double forage_share = 0.0;  // fraction of time spent foraging
+    size_t num_switches = 0;
+    double mean_fat_body = 0.0; // mean over the recorded events
+    double min_fat_body = 0.0;
+    size_t num_feedings = 0;    // counted from burnin onwards
+    double dominance = 0.0;
+  };
+
+  // single pass over the history of an individual
+  inline ant_summary summarise_ant(const individual& indiv,
+                                   time_type min_t, time_type max_t) {
+    ant_summary s;
+    s.num_feedings = indiv.get_num_feedings();
+    s.dominance = indiv.get_dominance();
+
+    const auto& data = indiv.get_data();
+    double task_time[2] = {0.0, 0.0};
+    double sum_fb = 0.0;
+    double min_fb = std::numeric_limits<double>::max();
+    size_t num_fb = 0;
+    for (size_t i = 0; i < data.size(); ++i) {
+      time_type start_t = data[i].t_;
+      time_type end_t = i + 1 < data.size() ? data[i + 1].t_ : max_t;
+
+      if (start_t >= min_t && start_t <= max_t) {
+        sum_fb += data[i].fb_;
+        min_fb = std::min(min_fb, static_cast<double>(data[i].fb_));
+        num_fb++;
+
+        if (end_t <= max_t) {
+          task_time[ static_cast<int>(data[i].current_task_) ] += end_t - start_t;
+          if (i + 1 < data.size() &&
+              data[i].current_task_ != data[i + 1].current_task_) {
+            s.num_switches++;
+          }
+        }
+      }
+    }
 
-   void write_dol_to_file(const std::vector< individual>& colony,
-                          const std::vector< ctype_>& param_values,
-                          const std::string& file_name,
-                          size_t num_repl,
-                          ctype_ burnin,
-                          ctype_ total_time) {
+    double total_time = task_time[0] + task_time[1];
+    if (total_time > 0.0) {
+      s.nurse_share  = task_time[0] / total_time;
+      s.forage_share = task_time[1] / total_time;
+    }
+    if (num_fb > 0) {
+      s.mean_fat_body = sum_fb / num_fb;
+      s.min_fat_body = min_fb;
+    }
+    return s;
+  }
 
-    std::cout << "writing dol to: " << file_name << "\n";
-    std::ofstream out(file_name.c_str(), std::ios::app);
+  struct dol_metrics {
+    double gautrais = 0.0;
+    double duarte = 0.0;
+    double gorelick_tasks = 0.0;
+    double gorelick_indiv = 0.0;
+    double gorelick_both = 0.0;
+  };
+
+  inline dol_metrics calculate_dol(const std::vector< individual>& colony,
+                                   time_type min_t, time_type max_t) {
+    dol_metrics dol;
+    dol.gautrais = calculate_gautrais(colony, min_t, max_t);
+    dol.duarte   = calculate_duarte(colony, min_t, max_t);
+    auto gorelick_stats = calculate_gorelick(colony, min_t, max_t);
+    dol.gorelick_tasks = std::get<0>(gorelick_stats);
+    dol.gorelick_indiv = std::get<1>(gorelick_stats);
+    dol.gorelick_both  = std::get<2>(gorelick_stats);
+    return dol;
+  }
+}
 
+namespace output {
+
+   // burnin_source: shared burn-in the replicate branched off, -1 if none
+   inline void write_dol(std::ostream& out,
+                         const std::vector< ctype_>& param_values,
+                         size_t num_repl,
+                         const stats::dol_metrics& dol,
+                         long burnin_source = -1) {
+    trace::scope s("output::write_dol");
     // write parameter values to file
     out << num_repl << "\t";
+    if (burnin_source >= 0) out << burnin_source << "\t";
     for (auto i : param_values) {
       out << i << "\t";
     }
 
-    ctype_ min_t = burnin * total_time;
-    ctype_ max_t = total_time;
-
-    double gautrais		= stats::calculate_gautrais(colony, min_t, max_t);
-    double duarte			= stats::calculate_duarte(colony, min_t, max_t);
-    auto gorelick_stats		= stats::calculate_gorelick(colony, min_t, max_t);
-
-    std::cout << "Gautrais 2002: " << gautrais << "\n";
-    std::cout << "Duarte 2012  : " << duarte   << "\n";
-    std::cout << "Gorelick 2004: ";
-
-    out << gautrais << "\t" << duarte << "\t";
-
-
-    double div_tasks = std::get<0>(gorelick_stats);
-    std::cout << div_tasks << " ";
-    out << div_tasks << "\t";
-
-    double div_indiv = std::get<1>(gorelick_stats);
-    std::cout << div_indiv << " ";
-    out << div_indiv << "\t";
-
-    double div_both = std::get<2>(gorelick_stats);
-    std::cout << div_both << "\n";
-    out << div_both << "\n";
-
-    out.close();
+    out << dol.gautrais << "\t" << dol.duarte << "\t" <<
+           dol.gorelick_tasks << "\t" <<
+           dol.gorelick_indiv << "\t" <<
+           dol.gorelick_both << "\n";
   }
 
-  void write_dol_headers(const std::vector<std::string>& param_names,
-                         const std::string& file_name,
-                         const std::string& window_file_name,
-                         size_t data_interval) {
-
-    std::ofstream out(file_name.c_str());
-    out << "repl\t";
-    for (auto i : param_names) {
-      out << i << "\t";
-    } out << "gautrais\tduarte\tgorelick_tasks\tgorelick_indiv\tgorelick_both\n";
-    out.close();
-
-    if (data_interval == 0) {
-      std::ofstream out(window_file_name.c_str());
-      out << "repl" << "\t" << "min_t" << "\t" << "max_t" << "\t" <<
-                "gautrais\tduarte\tgorelick_tasks\tgorelick_indiv\tgorelick_both\n";
-      out.close();
-    }
+  inline void write_dol_to_console(std::ostream& out,
+                                   const stats::dol_metrics& dol) {
+    out << "Gautrais 2002: " << dol.gautrais << "\n";
+    out << "Duarte 2012  : " << dol.duarte   << "\n";
+    out << "Gorelick 2004: " << dol.gorelick_tasks << " " <<
+                                dol.gorelick_indiv << " " <<
+                                dol.gorelick_both << "\n";
   }
 
-  void write_ants_to_file(const std::vector< individual>& colony,
-                          std::string file_name,
-                          size_t num_repl) {
-
-    if (num_repl == 0) {
-       std::ofstream out(file_name.c_str());
-      out << "replicate" << "\t" << "ID" << "\t" << "time" << "\t" << "task" << "\t" << "fat_body" << "\t" << "dominance" << "\n";
-      out.close();
-    }
-
-    std::ofstream out(file_name.c_str(), std::ios::app);
-    std::cout << "writing output to: " << file_name << "\n";
-
-
-    int cnt = 0;
-    for (const auto& i : colony) {
+  inline void write_ants(std::ostream& out,
+                         const std::vector< individual>& colony,
+                         const std::vector< size_t >& focal_ants,
+                         size_t num_repl) {
+    trace::scope s("output::write_ants");
+    for (auto cnt : focal_ants) {
+      const auto& i = colony[cnt];
       for (auto j : i.get_data()) {
         out << num_repl << "\t" << cnt << "\t" << j.t_ << "\t"
             << static_cast<int>(j.current_task_) << "\t" << j.fb_ << "\t" << i.get_dominance() << "\n"; // t, task, fat_body
 
       }
-      cnt++;
     }
-    out.close();
     return;
   }
 
-  void write_dol_sliding_window(const std::vector< individual>& colony,
-                                ctype_ window_size,
-                                ctype_ window_step_size,
-                                ctype_ simulation_time,
-                                std::string file_name,
-                                size_t num_repl) {
+  inline void write_ants_summary(std::ostream& out,
+                                 const std::vector< individual>& colony,
+                                 const std::vector< size_t >& focal_ants,
+                                 size_t num_repl,
+                                 time_type min_t, time_type max_t) {
+    trace::scope scope("output::write_ants_summary");
+    for (auto cnt : focal_ants) {
+      auto s = stats::summarise_ant(colony[cnt], min_t, max_t);
+      out << num_repl << "\t" << cnt << "\t" << s.nurse_share << "\t"
+          << s.forage_share << "\t" << s.num_switches << "\t"
+          << s.mean_fat_body << "\t" << s.min_fat_body << "\t"
+          << s.num_feedings << "\t" << s.dominance << "\n";
+    }
+  }
+
+  inline void write_snapshots(std::ostream& out,
+                              const std::vector< data_storage >& snapshots,
+                              size_t colony_size,
+                              size_t num_repl) {
+    trace::scope s("output::write_snapshots");
+    for (size_t i = 0; i < snapshots.size(); ++i) {
+      const auto& j = snapshots[i];
+      out << num_repl << "\t" << j.t_ << "\t" << i % colony_size << "\t"
+          << static_cast<int>(j.current_task_) << "\t" << j.fb_ << "\n";
+    }
+  }
 
-    std::ofstream out(file_name.c_str(), std::ios::app);
-    std::cout << "writing windowed DoL output to: " << file_name << "\n";
+  inline void write_dol_sliding_window(std::ostream& out,
+                                       const std::vector< individual>& colony,
+                                       ctype_ window_size,
+                                       ctype_ window_step_size,
+                                       time_type simulation_time,
+                                       size_t num_repl) {
+    trace::scope s("output::write_dol_sliding_window");
 
-    for (ctype_ max_t = window_size; max_t <= simulation_time; max_t += window_step_size) {
-      ctype_ min_t = max_t - window_size;;
-      double gautrais = stats::calculate_gautrais(colony, min_t, max_t);
-      double duarte = stats::calculate_duarte(colony, min_t, max_t);
-      auto gorelick_stats = stats::calculate_gorelick(colony, min_t, max_t);
+    for (time_type max_t = window_size; max_t <= simulation_time; max_t += window_step_size) {
+      time_type min_t = max_t - window_size;
+      auto dol = stats::calculate_dol(colony, min_t, max_t);
 
       out << num_repl << "\t" << min_t << "\t" << max_t << "\t" <<
-              gautrais << "\t" << duarte << "\t" <<
-              std::get<0>(gorelick_stats) << "\t" <<
-              std::get<1>(gorelick_stats) << "\t" << 
-              std::get<2>(gorelick_stats) << "\n";
+              dol.gautrais << "\t" << dol.duarte << "\t" <<
+              dol.gorelick_tasks << "\t" <<
+              dol.gorelick_indiv << "\t" <<
+              dol.gorelick_both << "\n";
     }
-    out.close();
   }
 }
 
@@ -0,0 +1,67 @@
+/*
+ *  c_api_smoke.c
+ *  dol_fatbody_tj
+ *
+ *  Runs one simulation through dolsim.h from C99, linked against
+ *  libdolsim.a, to check that the header and the library are usable
+ *  without C++ (make test).
+ */
+
+#include <stdio.h>
+
+#include "../dolsim.h"
+
+static int failures = 0;
+
+static void check(int ok, const char* what) {
+  if (!ok) {
+    fprintf(stderr, "c api smoke test failed: %s\n", what);
+    failures++;
+  }
+}
+
+int main(void) {
+  dol_params p;
+  dol_default_params(&p);
+  p.colony_size = 20;
+  p.simulation_time = 200;
+  p.data_interval = 10;
+  p.seed = 3;
+
+  check(dol_api_version() == DOL_API_VERSION, "api version");
+  check(dol_time_size() == sizeof(dol_time_t), "time precision");
+  check(dol_state_size() == sizeof(dol_state_t), "state precision");
+
+  dol_simulation* sim = dol_create(&p);
+  check(sim != NULL, "create");
+  if (sim == NULL) return 1;
+
+  check(dol_run_until(sim, 100.0) == DOL_OK, "run until");
+  check(dol_time(sim) == 100.0, "time after run until");
+  uint64_t counts[3];
+  check(dol_task_counts(sim, counts) == DOL_OK, "task counts");
+  check(counts[0] + counts[1] + counts[2] == p.colony_size, "task counts add up");
+
+  check(dol_run(sim) == DOL_OK, "run");
+  check(dol_finished(sim), "finished");
+
+  const dol_record* records = NULL;
+  size_t num_records = 0;
+  check(dol_history(sim, 0, &records, &num_records) == DOL_OK, "history");
+  check(num_records > 0 && records[num_records - 1].t == 200.0, "history ends at simulation_time");
+  check(dol_snapshots(sim, &records, &num_records) == DOL_OK, "snapshots");
+  check(num_records == p.colony_size * 21, "snapshots at 0, 10, ..., 200");
+
+  dol_metrics m;
+  check(dol_calculate_dol(sim, 50.0, 200.0, &m) == DOL_OK, "dol metrics");
+  check(m.gautrais >= 0.0 && m.gautrais <= 1.0, "gautrais in [0, 1]");
+
+  check(dol_history(sim, p.colony_size, &records, &num_records) == DOL_ERROR, "ant out of range");
+  check(dol_last_error()[0] != '\0', "error message");
+  dol_destroy(sim);
+
+  p.model_type = 7;
+  check(dol_create(&p) == NULL, "invalid model_type");
+
+  return failures == 0 ? 0 : 1;
+}
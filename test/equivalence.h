@@ -0,0 +1,362 @@
+//
+//  equivalence.h
+//  dol_fatbody_tj
+//
+//  Golden-trace harness: runs a matrix of configurations with a fixed seed
+//  through the reference engine (serial update_colony with the linear scan)
+//  and through each optimised engine, and compares the per-event history
+//  of every ant, the snapshots and the DoL metrics. Engines that should be
+//  bit-exact are compared exactly; the radix scheduler rounds event times
+//  up to whole ticks and is compared within a declared tolerance. The
+//  reference engine itself is compared with histories checked in under
+//  test/, so that a change in code shared by all engines is found too.
+//  The first divergence is reported as a message, empty if there is none.
+//
+#ifndef equivalence_h
+#define equivalence_h
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../parameters.h"
+#include "../simulation.h"
+#include "../batch_simulation.h"
+#include "../statistics.h"
+
+namespace equivalence {
+
+  // largest accepted differences, all 0 for bit-exact engines. Tasks and
+  // the number of events and feedings always match exactly. Times may
+  // drift by time_per_event with every event of an ant, as rounding to a
+  // tick does. DoL metrics are compared relative to their size. Without
+  // histories only the DoL metrics are compared.
+  struct tolerance {
+    double time = 0.0;
+    double time_per_event = 0.0;
+    double fat_body = 0.0;
+    double dol = 0.0;
+    bool histories = true;
+  };
+
+  struct config {
+    std::string name;
+    params p;
+  };
+
+  // finished replicates 0 .. n - 1 of p, by one engine
+  using engine_run = std::function< std::vector< std::unique_ptr<Simulation> >(const params&, size_t) >;
+
+  struct engine {
+    std::string name;
+    engine_run run;
+    tolerance tol;
+    bool per_ant_rng = false;  // compare against the reference with per_ant_rng
+  };
+
+  inline params replicate_params(const params& p, size_t repl) {
+    params r = p;
+    r.seed = p.seed + repl;
+    return r;
+  }
+
+  inline std::vector< std::unique_ptr<Simulation> > run_serial(const params& p, size_t n) {
+    std::vector< std::unique_ptr<Simulation> > sims;
+    for (size_t i = 0; i < n; ++i) {
+      sims.push_back(create_simulation(replicate_params(p, i)));
+      sims.back()->run();
+    }
+    return sims;
+  }
+
+  // a bit test, which -ffast-math cannot assume away as it does std::isnan
+  inline bool is_nan(double x) {
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return (bits & 0x7fffffffffffffffull) > 0x7ff0000000000000ull;
+  }
+
+  inline bool close(double x, double y, double tol) {
+    if (is_nan(x) || is_nan(y)) return is_nan(x) && is_nan(y);
+    return x == y || std::abs(x - y) <= tol;
+  }
+
+  inline bool close_relative(double x, double y, double tol) {
+    return close(x, y, tol * std::max(std::abs(x), std::abs(y)));
+  }
+
+  // first difference between two histories of ant a, empty if none
+  inline std::string compare_history(size_t a,
+                                     const std::vector< data_storage >& x,
+                                     const std::vector< data_storage >& y,
+                                     const tolerance& tol) {
+    std::ostringstream msg;
+    for (size_t j = 0; j < std::min(x.size(), y.size()); ++j) {
+      if (x[j].current_task_ != y[j].current_task_ ||
+          !close(x[j].t_, y[j].t_, tol.time + (j + 1) * tol.time_per_event) ||
+          !close(x[j].fb_, y[j].fb_, tol.fat_body)) {
+        msg << "ant " << a << ", event " << j << ": (t, task, fat body) = ("
+            << x[j].t_ << ", " << static_cast<int>(x[j].current_task_) << ", " << x[j].fb_
+            << ") vs (" << y[j].t_ << ", " << static_cast<int>(y[j].current_task_) << ", "
+            << y[j].fb_ << ")";
+        return msg.str();
+      }
+    }
+    if (x.size() != y.size()) {
+      msg << "ant " << a << ": " << x.size() << " vs " << y.size() << " events";
+    }
+    return msg.str();
+  }
+
+  // first difference between two finished replicates, empty if none
+  inline std::string compare(const Simulation& ref, const Simulation& sim, const tolerance& tol) {
+    std::ostringstream msg;
+    if (ref.colony.size() != sim.colony.size()) {
+      msg << "colony size " << ref.colony.size() << " vs " << sim.colony.size();
+      return msg.str();
+    }
+    for (size_t a = 0; tol.histories && a < ref.colony.size(); ++a) {
+      auto diff = compare_history(a, ref.colony[a].get_data(), sim.colony[a].get_data(), tol);
+      if (!diff.empty()) return diff;
+      if (ref.colony[a].get_num_feedings() != sim.colony[a].get_num_feedings()) {
+        msg << "ant " << a << ": " << ref.colony[a].get_num_feedings() << " vs "
+            << sim.colony[a].get_num_feedings() << " feedings";
+        return msg.str();
+      }
+    }
+    if (tol.histories && ref.snapshots.size() != sim.snapshots.size()) {
+      msg << ref.snapshots.size() << " vs " << sim.snapshots.size() << " snapshot records";
+      return msg.str();
+    }
+    for (size_t j = 0; tol.histories && j < ref.snapshots.size(); ++j) {
+      const auto& x = ref.snapshots[j];
+      const auto& y = sim.snapshots[j];
+      if (x.current_task_ != y.current_task_ || x.t_ != y.t_ ||
+          !close(x.fb_, y.fb_, tol.fat_body)) {
+        msg << "snapshot record " << j << ": fat body " << x.fb_ << " vs " << y.fb_;
+        return msg.str();
+      }
+    }
+
+    const time_type min_t = ref.p.burnin * static_cast<time_type>(ref.p.simulation_time);
+    const time_type max_t = static_cast<time_type>(ref.p.simulation_time);
+    const auto dx = stats::calculate_dol(ref.colony, min_t, max_t);
+    const auto dy = stats::calculate_dol(sim.colony, min_t, max_t);
+    const double x[] = {dx.gautrais, dx.duarte, dx.gorelick_tasks, dx.gorelick_indiv, dx.gorelick_both};
+    const double y[] = {dy.gautrais, dy.duarte, dy.gorelick_tasks, dy.gorelick_indiv, dy.gorelick_both};
+    const char* names[] = {"gautrais", "duarte", "gorelick_tasks", "gorelick_indiv", "gorelick_both"};
+    for (size_t i = 0; i < 5; ++i) {
+      if (!close_relative(x[i], y[i], tol.dol)) {
+        msg << names[i] << " " << x[i] << " vs " << y[i];
+        return msg.str();
+      }
+    }
+    return "";
+  }
+
+  // the four sharing models, each with edge cases
+  inline std::vector< config > config_matrix(size_t colony_size, size_t simulation_time) {
+    std::vector< config > configs;
+    for (auto model : {share_model::no, share_model::fair,
+                       share_model::dominance, share_model::fat_body}) {
+      params p;
+      p.colony_size = colony_size;
+      p.simulation_time = simulation_time;
+      p.seed = 11;
+      p.model_type = model;
+      p.data_interval = 0;
+      p.burnin = 0.25f;
+      const std::string m = "model " + std::to_string(static_cast<int>(model));
+
+      configs.push_back({m, p});
+
+      params snapshots = p;
+      snapshots.data_interval = 10;
+      configs.push_back({m + ", snapshots", snapshots});
+
+      params no_cost = p;
+      no_cost.metabolic_cost_nurses = 0.f;
+      no_cost.metabolic_cost_foragers = 0.f;
+      configs.push_back({m + ", zero metabolic costs", no_cost});
+
+      params forager_cost = p;
+      forager_cost.metabolic_cost_nurses = 0.f;
+      configs.push_back({m + ", zero nurse cost", forager_cost});
+
+      params many = p;
+      many.max_number_interactions = 10 * colony_size;
+      configs.push_back({m + ", more interactions than nurses", many});
+
+      params none = p;
+      none.max_number_interactions = 0;
+      configs.push_back({m + ", no interactions", none});
+    }
+    return configs;
+  }
+
+  inline std::vector< engine > engines() {
+    std::vector< engine > e;
+
+    e.push_back({"simd scheduler", [](const params& p, size_t n) {
+      params q = p;
+      q.scheduler = scheduler_type::simd;
+      return run_serial(q, n);
+    }, tolerance(), false});
+
+    e.push_back({"batch engine", [](const params& p, size_t n) {
+      std::vector< std::unique_ptr<Simulation> > sims;
+      std::vector< Simulation* > lanes;
+      for (size_t i = 0; i < n; ++i) {
+        sims.push_back(create_simulation(replicate_params(p, i)));
+        lanes.push_back(sims.back().get());
+      }
+      BatchSimulation batch(lanes);
+      batch.run();
+      return sims;
+    }, tolerance(), false});
+
+    e.push_back({"reused simulation", [](const params& p, size_t n) {
+      // every replicate runs in the memory of an earlier, different one
+      std::vector< std::unique_ptr<Simulation> > sims;
+      for (size_t i = 0; i < n; ++i) {
+        sims.push_back(create_simulation(replicate_params(p, n + i)));
+        sims.back()->run();
+        sims.back()->reset(replicate_params(p, i).seed);
+        sims.back()->run();
+      }
+      return sims;
+    }, tolerance(), false});
+
+    e.push_back({"parallel colony", [](const params& p, size_t n) {
+      params q = p;
+      q.per_ant_rng = true;
+      q.num_colony_threads = 3;
+      return run_serial(q, n);
+    }, tolerance(), true});
+
+    // Every event is rounded up to a tick, and the next one is scheduled
+    // from there, so times drift by up to about a tick per event. Per-ant
+    // streams keep near ties that swap order from changing the random
+    // draws. Events less than a tick apart can still swap order and then
+    // change which nurses a forager meets; ticks of 1e-5 are fine enough
+    // that this does not happen in the matrix (at 1e-4 it does, with fat
+    // bodies off by 0.5), and fat bodies then differ by less than 5e-5.
+    tolerance ticks;
+    ticks.time_per_event = 2e-5;
+    ticks.fat_body = 1e-4;
+    ticks.dol = 1e-3;
+    e.push_back({"radix scheduler", [](const params& p, size_t n) {
+      params q = p;
+      q.scheduler = scheduler_type::radix;
+      q.time_resolution = 1e-5;
+      return run_serial(q, n);
+    }, ticks, true});
+
+    return e;
+  }
+
+  // Reference histories of the serial engine, one replicate of each
+  // sharing model, as stored in test/golden_history.txt. They hold for the
+  // float build with libstdc++, whose std::normal_distribution draws the
+  // thresholds. Times and fat bodies are compared within golden_tolerance(),
+  // which allows for contracted floating point operations (-march=native).
+  inline std::vector< config > golden_configs() {
+    std::vector< config > configs;
+    for (const auto& c : config_matrix(20, 200)) {
+      if (c.name.find(',') == std::string::npos) configs.push_back(c);
+    }
+    return configs;
+  }
+
+  inline tolerance golden_tolerance() {
+    tolerance tol;
+    tol.time = 1e-3;
+    tol.fat_body = 1e-3;
+    return tol;
+  }
+
+  // per config: "config <name>", then per ant "ant <index> <events>
+  // <feedings>" followed by one "<t> <task> <fat body>" line per event
+  inline void write_golden(std::ostream& out, const std::vector< config >& configs) {
+    out.precision(9);
+    for (const auto& c : configs) {
+      auto sims = run_serial(c.p, 1);
+      out << "config " << c.name << "\n";
+      for (size_t a = 0; a < sims[0]->colony.size(); ++a) {
+        const auto& ant = sims[0]->colony[a];
+        out << "ant " << a << " " << ant.get_data().size() << " " << ant.get_num_feedings() << "\n";
+        for (const auto& d : ant.get_data()) {
+          out << d.t_ << " " << static_cast<int>(d.current_task_) << " " << d.fb_ << "\n";
+        }
+      }
+    }
+  }
+
+  // first difference between the serial engine and the stored histories,
+  // empty if none
+  inline std::string compare_golden(std::istream& in, const std::vector< config >& configs,
+                                    const tolerance& tol) {
+    std::string word, name;
+    for (const auto& c : configs) {
+      in >> word;
+      std::getline(in >> std::ws, name);
+      if (!in || word != "config" || name != c.name) {
+        return "golden histories do not start config " + c.name;
+      }
+      auto sims = run_serial(c.p, 1);
+      for (size_t a = 0; a < sims[0]->colony.size(); ++a) {
+        size_t index = 0, num_events = 0, num_feedings = 0;
+        in >> word >> index >> num_events >> num_feedings;
+        if (!in || word != "ant" || index != a) {
+          return c.name + ": golden histories are truncated at ant " + std::to_string(a);
+        }
+        std::vector< data_storage > golden;
+        for (size_t j = 0; j < num_events; ++j) {
+          double t, fb;
+          int task_index;
+          in >> t >> task_index >> fb;
+          golden.push_back(data_storage(static_cast<time_type>(t), static_cast<task>(task_index),
+                                        static_cast<ctype_>(fb)));
+        }
+        const auto& ant = sims[0]->colony[a];
+        auto diff = compare_history(a, golden, ant.get_data(), tol);
+        if (diff.empty() && num_feedings != ant.get_num_feedings()) {
+          diff = "ant " + std::to_string(a) + ": " + std::to_string(num_feedings) + " vs " +
+                 std::to_string(ant.get_num_feedings()) + " feedings";
+        }
+        if (!diff.empty()) return "golden, " + c.name + ": " + diff;
+      }
+    }
+    return "";
+  }
+
+  // first divergence of any engine on any config, empty if none
+  inline std::string run(const std::vector< config >& configs,
+                         const std::vector< engine >& engines,
+                         size_t replicates) {
+    for (const auto& c : configs) {
+      for (const auto& e : engines) {
+        params ref_par = c.p;
+        ref_par.per_ant_rng = e.per_ant_rng;
+        auto ref = run_serial(ref_par, replicates);
+        auto sims = e.run(ref_par, replicates);
+        for (size_t r = 0; r < replicates; ++r) {
+          auto diff = compare(*ref[r], *sims[r], e.tol);
+          if (!diff.empty()) {
+            return e.name + ", " + c.name + ", replicate " + std::to_string(r) + ": " + diff;
+          }
+        }
+      }
+    }
+    return "";
+  }
+}
+
+#endif /* equivalence_h */
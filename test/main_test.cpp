@@ -5,7 +5,16 @@
 #include "../simulation.h"
 #include "../individual.h"
 #include "../statistics.h"
-
+#include "../batch_simulation.h"
+#include "../output_sink.h"
+#include "../aggregate.h"
+#include "../pipeline.h"
+#include "../perf_counters.h"
+#include "../observer.h"
+#include "equivalence.h"
+#include "../dolsim.h"
+
+#include <cstdlib>
 #include <fstream>
 #include <string>
 
@@ -276,6 +285,7 @@ TEST_CASE("TEST sharing") {
   std::vector< ctype_ > share_amount =
               no_sharing_grouped(&indivs[0],
                                         nurses,
+                                        0.f, // t
                                         parameters.soft_max,
                                         1);
   REQUIRE(share_amount[0] == 0.f);
@@ -283,6 +293,7 @@ TEST_CASE("TEST sharing") {
   share_amount =
               fair_sharing_grouped(&indivs[0],
                                         nurses,
+                                        0.f, // t
                                         parameters.soft_max,
                                         1);
   REQUIRE(share_amount[0] == 0.5f);
@@ -290,6 +301,7 @@ TEST_CASE("TEST sharing") {
   share_amount =
                   dominance_sharing_grouped(&indivs[0],
                                             nurses,
+                                            0.f, // t
                                             0, // 0 defaults to fair sharing
                                             1);
   REQUIRE(share_amount[0] == 0.5f);
@@ -300,6 +312,7 @@ TEST_CASE("TEST sharing") {
   share_amount =
   dominance_sharing_grouped(&indivs[0],
                             nurses,
+                            0.f, // t
                             1,
                             1);
 
@@ -311,14 +324,16 @@ TEST_CASE("TEST sharing") {
   share_amount =
   dominance_sharing_grouped(&indivs[0],
                             nurses,
+                            0.f, // t
                             100, // s
                             1);
   
-  REQUIRE(share_amount[0] == 1.0f);
+  REQUIRE(share_amount[0] == Approx(1.0)); // 1 - e^-30 in double precision
 
   share_amount =
   dominance_sharing_grouped(&indivs[0],
                             nurses,
+                            0.f, // t
                             10, // s
                             1);
 
@@ -329,6 +344,7 @@ TEST_CASE("TEST sharing") {
   share_amount =
                   fatbody_sharing_grouped(&indivs[0],
                                             nurses,
+                                            0.f, // t
                                             0, // 0 defaults to fair sharing
                                             1);
   REQUIRE(share_amount[0] == 0.5f);
@@ -340,6 +356,7 @@ TEST_CASE("TEST sharing") {
   share_amount =
   fatbody_sharing_grouped(&indivs[0],
                             nurses,
+                            0.f, // t
                             1,
                             1);
 
@@ -350,17 +367,1067 @@ TEST_CASE("TEST sharing") {
 
   share_amount = fatbody_sharing_grouped(&indivs[0],
                                           nurses,
+                                          0.f, // t
                                           100, // s
                                           1);
 
-  REQUIRE(share_amount[0] == 1.0f);
+  REQUIRE(share_amount[0] == Approx(1.0));
 
   share_amount =
   fatbody_sharing_grouped(&indivs[0],
                             nurses,
+                            0.f, // t
                             10, // s
                             1);
 
   REQUIRE(share_amount[0] > 0.4 / 0.5);
 }
 
+
+TEST_CASE("TEST bounded queue") {
+  pipeline::bounded_queue<int> q(2);
+  CHECK(q.push(1));
+  CHECK(q.push(2));
+
+  std::thread consumer([&]() {
+    int x;
+    int expected = 1;
+    while (q.pop(x)) {
+      CHECK(x == expected);
+      expected++;
+    }
+    CHECK(expected == 11);
+  });
+
+  for (int i = 3; i <= 10; ++i) {
+    CHECK(q.push(i)); // blocks until the consumer has made room
+  }
+  q.close();
+  consumer.join();
+
+  CHECK(!q.push(11));
+
+  pipeline::write_window window(2);
+  CHECK(window.admit(0));
+  CHECK(window.admit(1));
+  std::thread writer([&]() {
+    for (size_t i = 1; i <= 4; ++i) window.written(i);
+  });
+  CHECK(window.admit(5)); // blocks until replicates 0 to 3 are written
+  writer.join();
+  window.close();
+  CHECK(!window.admit(6));
+}
+
+TEST_CASE("TEST pipeline order") {
+  params parameters;
+  parameters.simulation_time = 200;
+  parameters.colony_size = 20;
+  parameters.num_replicates = 12;
+  parameters.num_sim_threads = 4;
+  parameters.num_analysis_threads = 3;
+  parameters.queue_size = 1;
+  parameters.seed = 5;
+  parameters.dol_file_name = "test_pipeline_dol.txt";
+  parameters.snapshot_file_name = "";
+
+  // replicates finish out of order, but are written in order
+  std::ostringstream log;
+  auto cout_buf = std::cout.rdbuf(log.rdbuf());
+  {
+    output::sinks files(parameters);
+    aggregate::sweep_summary summary(parameters.param_names_to_record);
+    pipeline::run_replicates(parameters, files, summary);
+  }
+  std::cout.rdbuf(cout_buf);
+
+  std::ifstream in(parameters.dol_file_name.c_str());
+  std::string line;
+  std::getline(in, line);  // header
+  size_t repl = 0;
+  while (std::getline(in, line)) {
+    CHECK(std::stoul(line.substr(0, line.find('\t'))) == repl);
+    repl++;
+  }
+  CHECK(repl == parameters.num_replicates);
+  in.close();
+  std::remove(parameters.dol_file_name.c_str());
+}
+
+TEST_CASE("TEST output sink") {
+  std::string file_name = "test_sink_output.txt";
+  {
+    output::sink out(file_name, "header\n", 16);
+    out.write("replicate 0 with a line longer than the buffer\n");
+    out.flush();
+
+    std::ifstream in(file_name.c_str());
+    std::string line;
+    std::getline(in, line);
+    CHECK(line == "header");
+    std::getline(in, line);
+    CHECK(line == "replicate 0 with a line longer than the buffer");
+  }
+  std::remove(file_name.c_str());
+
+  output::sink disabled("", "header\n");
+  CHECK(!disabled.enabled());
+  disabled.write("ignored");
+  disabled.flush();
+
+  // sweep points share the sinks of the first point
+  params a, b;
+  b.resource_amount = 2.f;
+  CHECK(output::same_sinks(a, b));
+  b.window_file_name = "other_window.txt";
+  CHECK(output::same_sinks(a, b) == (a.data_interval > 0));
+  b.dol_file_name = "other_dol.txt";
+  CHECK(!output::same_sinks(a, b));
+}
+
+TEST_CASE("TEST snapshots") {
+  params parameters;
+  parameters.simulation_time = 100;
+  parameters.colony_size = 10;
+  parameters.data_interval = 10;
+
+  std::unique_ptr<Simulation> test_sim = create_simulation(parameters);
+  test_sim->run();
+
+  // snapshots at t = 0, 10, ..., 100
+  REQUIRE(test_sim->snapshots.size() == 11 * parameters.colony_size);
+  for (size_t i = 0; i < test_sim->snapshots.size(); ++i) {
+    CHECK(test_sim->snapshots[i].t_ == 10.f * (i / parameters.colony_size));
+    CHECK(test_sim->snapshots[i].fb_ >= 0.f);
+  }
+  // the last snapshot is taken at the end roll call
+  for (size_t i = 0; i < parameters.colony_size; ++i) {
+    const auto& snap = test_sim->snapshots[10 * parameters.colony_size + i];
+    CHECK(snap.fb_ == test_sim->colony[i].get_fat_body());
+  }
+
+  parameters.data_interval = 0;
+  std::unique_ptr<Simulation> test_sim2 = create_simulation(parameters);
+  test_sim2->run();
+  CHECK(test_sim2->snapshots.empty());
+}
+
+TEST_CASE("TEST focal ants") {
+  params parameters;
+  parameters.colony_size = 10;
+  CHECK(parameters.get_focal_ants().size() == 10);
+
+  parameters.focal_ants = "0.25";
+  auto focal = parameters.get_focal_ants();
+  REQUIRE(focal.size() == 3);
+  CHECK(focal[2] == 2);
+
+  parameters.focal_ants = "7,1,1";
+  focal = parameters.get_focal_ants();
+  REQUIRE(focal.size() == 2);
+  CHECK(focal[0] == 1);
+  CHECK(focal[1] == 7);
+
+  parameters.focal_ants = "10";
+  CHECK_THROWS(parameters.get_focal_ants());
+}
+
+TEST_CASE("TEST ant summary") {
+  params parameters;
+  parameters.burnin = 0.f;
+  rnd_t rndgen(parameters.mean_threshold, parameters.sd_threshold);
+
+  individual test_indiv;
+  test_indiv.initialize(parameters, rndgen, fair_sharing_grouped);
+  // initialize records a nurse at t = 0 with fb = init_fat_body
+  test_indiv.set_fat_body(2.f);
+  test_indiv.set_current_task(task::forage);
+  test_indiv.update_data(1.f);
+  test_indiv.set_fat_body(4.f);
+  test_indiv.set_current_task(task::nurse);
+  test_indiv.update_data(4.f);
+
+  test_indiv.handle_food(1.f, 4.f, 0.5f);
+
+  auto s = stats::summarise_ant(test_indiv, 0.f, 5.f);
+  // nurse 0-1 and 4-5, forager 1-4
+  CHECK(s.nurse_share == Approx(0.4));
+  CHECK(s.forage_share == Approx(0.6));
+  CHECK(s.num_switches == 2);
+  CHECK(s.mean_fat_body == Approx((parameters.init_fat_body + 2.0 + 4.0) / 3.0));
+  CHECK(s.min_fat_body == 2.0);
+  CHECK(s.num_feedings == 1);
+  CHECK(s.dominance == test_indiv.get_dominance());
+}
+
+TEST_CASE("TEST aggregate") {
+  aggregate::welford w;
+  aggregate::p2_quantile median(0.5);
+  aggregate::p2_quantile q95(0.95);
+  std::vector<double> values;
+  for (int i = 0; i < 1001; ++i) {
+    double x = (i * 7919) % 1001; // permutation of 0 ... 1000
+    values.push_back(x);
+    w.add(x);
+    median.add(x);
+    q95.add(x);
+  }
+  double mean = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+  double ss = 0.0;
+  for (auto x : values) ss += (x - mean) * (x - mean);
+
+  CHECK(w.n == 1001);
+  CHECK(w.mean == Approx(mean));
+  CHECK(w.variance() == Approx(ss / 1000));
+  CHECK(median.value() == Approx(500).margin(10));
+  CHECK(q95.value() == Approx(950).margin(10));
+
+  aggregate::p2_quantile small(0.5);
+  small.add(3.0);
+  small.add(1.0);
+  CHECK(small.value() == 2.0);
+
+  params p;
+  p.param_names_to_record = {"resource_amount"};
+  aggregate::sweep_summary summary(p.param_names_to_record);
+  stats::dol_metrics dol;
+  dol.gautrais = 1.0;
+  dol.duarte = std::numeric_limits<double>::quiet_NaN();
+  dol.gorelick_tasks = -std::numeric_limits<double>::infinity();
+  p.params_to_record = {1.f};
+  summary.add(p, dol);
+  summary.add(p, dol);
+  p.params_to_record = {2.f};
+  summary.add(p, dol);
+
+  CHECK(summary.num_points() == 2);
+  CHECK(summary.at({1.f}).num_repl == 2);
+  CHECK(summary.at({1.f}).gautrais.moments.mean == 1.0);
+  CHECK(summary.at({1.f}).duarte.moments.n == 0);
+  CHECK(summary.at({1.f}).gorelick_tasks.moments.n == 0);
+
+  p.param_names_to_record = {"foraging_time"};
+  CHECK_THROWS(summary.add(p, dol));
+}
+
+TEST_CASE("TEST parallel colony update") {
+  params parameters;
+  parameters.simulation_time = 500;
+  parameters.colony_size = 50;
+  parameters.data_interval = 25;
+  parameters.seed = 42;
+  parameters.per_ant_rng = true;
+
+  for (auto model : {share_model::no, share_model::fair,
+                     share_model::dominance, share_model::fat_body}) {
+    parameters.model_type = model;
+
+    parameters.num_colony_threads = 1;
+    std::unique_ptr<Simulation> serial_sim = create_simulation(parameters);
+    serial_sim->run();
+
+    parameters.num_colony_threads = 3;
+    std::unique_ptr<Simulation> parallel_sim = create_simulation(parameters);
+    parallel_sim->run();
+
+    // identical histories, regardless of the order of processing
+    for (size_t i = 0; i < parameters.colony_size; ++i) {
+      const auto& a = serial_sim->colony[i].get_data();
+      const auto& b = parallel_sim->colony[i].get_data();
+      REQUIRE(a.size() == b.size());
+      for (size_t j = 0; j < a.size(); ++j) {
+        CHECK(a[j].t_ == b[j].t_);
+        CHECK(a[j].fb_ == b[j].fb_);
+        CHECK(a[j].current_task_ == b[j].current_task_);
+      }
+    }
+    REQUIRE(serial_sim->snapshots.size() == parallel_sim->snapshots.size());
+    for (size_t j = 0; j < serial_sim->snapshots.size(); ++j) {
+      CHECK(serial_sim->snapshots[j].fb_ == parallel_sim->snapshots[j].fb_);
+      CHECK(serial_sim->snapshots[j].current_task_ == parallel_sim->snapshots[j].current_task_);
+    }
+  }
+}
+
+TEST_CASE("TEST batch simulation") {
+  params parameters;
+  parameters.simulation_time = 300;
+  parameters.colony_size = 30;
+  parameters.data_interval = 50;
+
+  for (auto model : {share_model::no, share_model::fair,
+                     share_model::dominance, share_model::fat_body}) {
+    parameters.model_type = model;
+
+    std::vector< std::unique_ptr<Simulation> > reference;
+    std::vector< std::unique_ptr<Simulation> > lanes;
+    std::vector< Simulation* > lane_ptrs;
+    for (size_t r = 0; r < 5; ++r) {
+      parameters.seed = 100 + r;
+      reference.push_back(create_simulation(parameters));
+      reference.back()->run();
+      lanes.push_back(create_simulation(parameters));
+      lane_ptrs.push_back(lanes.back().get());
+    }
+
+    BatchSimulation batch(lane_ptrs);
+    batch.run();
+
+    for (size_t r = 0; r < 5; ++r) {
+      CHECK(lanes[r]->t == reference[r]->t);
+      REQUIRE(lanes[r]->snapshots.size() == reference[r]->snapshots.size());
+      for (size_t j = 0; j < lanes[r]->snapshots.size(); ++j) {
+        CHECK(lanes[r]->snapshots[j].fb_ == reference[r]->snapshots[j].fb_);
+      }
+      for (size_t i = 0; i < parameters.colony_size; ++i) {
+        const auto& a = lanes[r]->colony[i];
+        const auto& b = reference[r]->colony[i];
+        CHECK(a.get_fat_body() == b.get_fat_body());
+        CHECK(a.get_next_t() == b.get_next_t());
+        CHECK(a.get_task() == b.get_task());
+        CHECK(a.get_num_feedings() == b.get_num_feedings());
+        REQUIRE(a.get_data().size() == b.get_data().size());
+        for (size_t j = 0; j < a.get_data().size(); ++j) {
+          CHECK(a.get_data()[j].t_ == b.get_data()[j].t_);
+          CHECK(a.get_data()[j].fb_ == b.get_data()[j].fb_);
+          CHECK(a.get_data()[j].current_task_ == b.get_data()[j].current_task_);
+        }
+      }
+    }
+  }
+
+  // per-ant random streams go through the same individual code
+  parameters.per_ant_rng = true;
+  parameters.seed = 100;
+  auto reference = create_simulation(parameters);
+  reference->run();
+  auto lane = create_simulation(parameters);
+  std::vector< Simulation* > lane_ptrs = {lane.get()};
+  BatchSimulation batch(lane_ptrs);
+  batch.run();
+  for (size_t i = 0; i < parameters.colony_size; ++i) {
+    CHECK(lane->colony[i].get_data().size() == reference->colony[i].get_data().size());
+    CHECK(lane->colony[i].get_fat_body() == reference->colony[i].get_fat_body());
+  }
+
+  parameters.batch_size = 4;
+  CHECK(parameters.use_batch_engine());
+  parameters.scheduler = scheduler_type::radix;
+  CHECK_THROWS(parameters.use_batch_engine());
+  parameters.scheduler = scheduler_type::scan;
+  parameters.resume = true;
+  CHECK_THROWS(parameters.use_batch_engine());
+}
+
+TEST_CASE("TEST next event selector") {
+  std::mt19937 rng(5);
+  std::uniform_int_distribution<int> d(0, 20); // few values, many ties
+  for (size_t n : {1, 7, 16, 64, 100, 128, 256, 500, 512}) {
+    next_event::simd_selector<float> selector;
+    selector.resize(n);
+    std::vector<float> v(n);
+    for (size_t i = 0; i < n; ++i) {
+      v[i] = static_cast<float>(d(rng));
+      selector.set(i, v[i]);
+    }
+    CHECK(selector.argmin() == next_event::argmin_scalar(v.data(), n));
+    v[n - 1] = -1.f;
+    selector.set(n - 1, -1.f);
+    CHECK(selector.argmin() == n - 1);
+  }
+
+  params parameters;
+  parameters.simulation_time = 300;
+  parameters.colony_size = 40;
+  parameters.seed = 3;
+  for (auto model : {share_model::no, share_model::fair,
+                     share_model::dominance, share_model::fat_body}) {
+    parameters.model_type = model;
+    parameters.scheduler = scheduler_type::scan;
+    auto scan_sim = create_simulation(parameters);
+    scan_sim->run();
+    parameters.scheduler = scheduler_type::simd;
+    auto simd_sim = create_simulation(parameters);
+    simd_sim->run();
+
+    for (size_t i = 0; i < parameters.colony_size; ++i) {
+      const auto& a = scan_sim->colony[i].get_data();
+      const auto& b = simd_sim->colony[i].get_data();
+      REQUIRE(a.size() == b.size());
+      for (size_t j = 0; j < a.size(); ++j) {
+        CHECK(a[j].t_ == b[j].t_);
+        CHECK(a[j].fb_ == b[j].fb_);
+        CHECK(a[j].current_task_ == b[j].current_task_);
+      }
+    }
+  }
+}
+
+TEST_CASE("TEST radix heap") {
+  std::mt19937 rng(9);
+  std::uniform_int_distribution<uint64_t> d(0, 1000);
+  next_event::radix_heap<size_t> heap;
+  std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>> reference;
+  for (size_t i = 0; i < 100; ++i) {
+    uint64_t key = d(rng);
+    heap.push(key, i);
+    reference.push(key);
+  }
+  for (size_t i = 0; i < 10000; ++i) {
+    REQUIRE(heap.top().first == reference.top());
+    uint64_t last = reference.top();
+    heap.pop();
+    reference.pop();
+    // monotone: new keys are at least the last key popped
+    uint64_t key = last + d(rng) % 3 * d(rng);
+    heap.push(key, i);
+    reference.push(key);
+  }
+  CHECK(heap.size() == reference.size());
+
+  params parameters;
+  parameters.simulation_time = 300;
+  parameters.colony_size = 40;
+  parameters.seed = 3;
+  parameters.scheduler = scheduler_type::radix;
+  parameters.time_resolution = 0.01;
+  for (auto model : {share_model::no, share_model::fair,
+                     share_model::dominance, share_model::fat_body}) {
+    parameters.model_type = model;
+    auto sim = create_simulation(parameters);
+    sim->run();
+    CHECK(sim->tick * parameters.time_resolution >= 300 - parameters.time_resolution);
+    for (const auto& i : sim->colony) {
+      const auto& data = i.get_data();
+      for (size_t j = 1; j < data.size(); ++j) {
+        CHECK(data[j].t_ >= data[j - 1].t_);
+      }
+      CHECK(data.back().t_ == 300.f);
+    }
+  }
+
+  // ants rescheduled into the current tick follow in order of index
+  parameters.colony_size = 8;
+  parameters.max_number_interactions = 4;
+  auto sim = create_simulation(parameters);
+  for (size_t i = 0; i < sim->colony.size(); ++i) {
+    sim->colony[i].start_task(i == 5 ? 10.f : 50.f, task::nurse);
+    sim->schedule(i);
+  }
+  CHECK(sim->find_next_individual() - sim->colony.begin() == 5);
+  sim->colony[5].start_task(50.f, task::nurse);
+  sim->nurses = {&sim->colony[2], &sim->colony[0], &sim->colony[6], &sim->colony[1]};
+  for (auto i : sim->nurses) i->start_task(10.f, task::nurse);
+  sim->reschedule(5);
+  sim->nurses.clear();
+  for (size_t expected : {0, 1, 2, 6}) {
+    CHECK(sim->next_event_time() == Approx(10.0));
+    const auto next = sim->find_next_individual() - sim->colony.begin();
+    CHECK(next == expected);
+    sim->colony[next].start_task(50.f, task::nurse);
+    sim->reschedule(next);
+  }
+  CHECK(sim->next_event_time() == Approx(50.0));
+  CHECK(sim->find_next_individual() - sim->colony.begin() == 0);
+}
+
+TEST_CASE("TEST lazy fat body") {
+  params parameters;
+  parameters.metabolic_cost_nurses = 0.5f;
+  parameters.metabolic_cost_foragers = 0.5f;
+  rnd_t rndgen(parameters.mean_threshold, parameters.sd_threshold, 1);
+
+  std::vector<individual> indivs(2);
+  for (auto& i : indivs) i.initialize(parameters, rndgen, fatbody_sharing_grouped);
+
+  // forager brought forward to t = 10, nurse last updated at t = 0
+  indivs[0].set_fat_body(5.f);
+  indivs[0].set_previous_t(10.f);
+  indivs[1].set_current_task(task::nurse);
+  indivs[1].set_fat_body(10.f);
+  indivs[1].set_previous_t(0.f);
+
+  CHECK(indivs[1].get_fat_body_at(10.f) == 5.f);
+  CHECK(indivs[1].get_fat_body_at(40.f) == 0.f);
+
+  std::vector<individual*> nurses = {&indivs[1]};
+  auto share_amount = fatbody_sharing_grouped(&indivs[0], nurses, 10.f, 1, 1);
+  CHECK(share_amount[0] == Approx(0.5f));
+  CHECK(indivs[1].get_fat_body() == 10.f); // reading does not change the nurse
+}
+
+TEST_CASE("TEST checkpoint") {
+  params parameters;
+  parameters.simulation_time = 300;
+  parameters.colony_size = 30;
+  parameters.data_interval = 10;
+  parameters.seed = 11;
+
+  auto check_equal = [&](const Simulation& a, const Simulation& b) {
+    CHECK(a.t == b.t);
+    REQUIRE(a.snapshots.size() == b.snapshots.size());
+    for (size_t j = 0; j < a.snapshots.size(); ++j) {
+      CHECK(a.snapshots[j].fb_ == b.snapshots[j].fb_);
+    }
+    for (size_t i = 0; i < parameters.colony_size; ++i) {
+      const auto& x = a.colony[i].get_data();
+      const auto& y = b.colony[i].get_data();
+      REQUIRE(x.size() == y.size());
+      for (size_t j = 0; j < x.size(); ++j) {
+        CHECK(x[j].t_ == y[j].t_);
+        CHECK(x[j].fb_ == y[j].fb_);
+        CHECK(x[j].current_task_ == y[j].current_task_);
+      }
+      CHECK(a.colony[i].get_num_feedings() == b.colony[i].get_num_feedings());
+    }
+  };
+
+  for (auto scheduler : {scheduler_type::scan, scheduler_type::simd, scheduler_type::radix}) {
+    for (bool per_ant_rng : {false, true}) {
+      parameters.scheduler = scheduler;
+      parameters.per_ant_rng = per_ant_rng;
+
+      auto reference = create_simulation(parameters);
+      reference->run();
+
+      // stop halfway, and continue in a new simulation
+      auto first_half = create_simulation(parameters);
+      while (first_half->t < 150) first_half->update_colony();
+      std::stringstream state;
+      first_half->save_state(state);
+
+      parameters.seed = 12; // the checkpoint replaces the random state
+      auto second_half = create_simulation(parameters);
+      parameters.seed = 11;
+      second_half->load_state(state);
+      second_half->run();
+      check_equal(*reference, *second_half);
+    }
+  }
+
+  // through the background writer
+  parameters.scheduler = scheduler_type::scan;
+  parameters.per_ant_rng = false;
+  parameters.checkpoint_interval = 50;
+  parameters.checkpoint_file_name = "test_checkpoint";
+  const auto file_name = checkpoint::file_name(parameters, 0);
+  auto sim = create_simulation(parameters);
+  sim->enable_checkpoints(file_name);
+  sim->run();
+  auto resumed = create_simulation(parameters);
+  resumed->load_checkpoint(file_name);
+  resumed->run();
+  check_equal(*sim, *resumed);
+  parameters.seed = 12;
+  auto other_seed = create_simulation(parameters);
+  CHECK_THROWS(other_seed->load_checkpoint(file_name));
+  parameters.seed = 11;
+  std::remove(file_name.c_str());
+
+  parameters.colony_size = 31;
+  auto other = create_simulation(parameters);
+  std::stringstream state;
+  sim->save_state(state);
+  CHECK_THROWS(other->load_state(state));
+
+  parameters.colony_size = 30;
+  parameters.metabolic_cost_foragers = 0.08f;
+  auto other_cost = create_simulation(parameters);
+  state.seekg(0);
+  CHECK_THROWS(other_cost->load_state(state));
+
+  // the points of a sweep have their own checkpoints
+  parameters.params_to_record = {2.5f};
+  CHECK(checkpoint::file_name(parameters, 3) == "test_checkpoint_2.5_3.bin");
+}
+
+TEST_CASE("TEST shared burnin") {
+  params parameters;
+  parameters.simulation_time = 300;
+  parameters.colony_size = 30;
+  parameters.burnin = 0.25f;
+  parameters.seed = 21;
+  parameters.num_replicates = 4;
+  parameters.shared_burnin = 1;
+
+  for (auto scheduler : {scheduler_type::scan, scheduler_type::radix}) {
+    parameters.scheduler = scheduler;
+    // stopping at the burn-in does not change the run
+    auto reference = create_simulation(parameters);
+    reference->run();
+    auto stepped = create_simulation(parameters);
+    stepped->run_until(75);
+    CHECK(stepped->t == 75);
+    stepped->run();
+    for (size_t i = 0; i < parameters.colony_size; ++i) {
+      CHECK(stepped->colony[i].get_data().size() == reference->colony[i].get_data().size());
+      CHECK(stepped->colony[i].get_fat_body() == reference->colony[i].get_fat_body());
+    }
+
+    // branches share the burn-in, and differ afterwards
+    auto burnins = pipeline::run_burnins(parameters);
+    REQUIRE(burnins.size() == 1);
+    auto a = create_simulation(parameters);
+    auto b = create_simulation(parameters);
+    pipeline::branch_replicate(*a, parameters, 0, burnins);
+    pipeline::branch_replicate(*b, parameters, 1, burnins);
+    a->run();
+    b->run();
+    size_t num_different = 0;
+    for (size_t i = 0; i < parameters.colony_size; ++i) {
+      const auto& x = a->colony[i].get_data();
+      const auto& y = b->colony[i].get_data();
+      size_t j = 0;
+      for (; j < std::min(x.size(), y.size()) && x[j].t_ < 75; ++j) {
+        CHECK(x[j].t_ == y[j].t_);
+        CHECK(x[j].fb_ == y[j].fb_);
+      }
+      if (x.size() != y.size() || x.back().fb_ != y.back().fb_) num_different++;
+    }
+    CHECK(num_different > 0);
+  }
+}
+
+TEST_CASE("TEST history retention") {
+  params parameters;
+  parameters.simulation_time = 400;
+  parameters.colony_size = 30;
+  parameters.burnin = 0.5f;
+  parameters.seed = 4;
+
+  for (auto model : {share_model::fair, share_model::fat_body}) {
+    parameters.model_type = model;
+    parameters.retain_history = history_retention::all;
+    auto full = create_simulation(parameters);
+    full->run();
+    parameters.retain_history = history_retention::after_burnin;
+    REQUIRE(parameters.drop_burnin_history());
+    auto compact = create_simulation(parameters);
+    compact->run();
+
+    const time_type min_t = 200;
+    const time_type max_t = 400;
+    for (size_t i = 0; i < parameters.colony_size; ++i) {
+      const auto& x = full->colony[i].get_data();
+      const auto& y = compact->colony[i].get_data();
+      REQUIRE(y.size() <= x.size());
+      // one record before the burn-in, then the same records as the full history
+      CHECK(y[0].t_ < min_t);
+      CHECK(y[1].t_ >= min_t);
+      const size_t offset = x.size() - y.size();
+      CHECK(x[offset].t_ == y[0].t_);
+      for (size_t j = 0; j < y.size(); ++j) {
+        CHECK(x[j + offset].t_ == y[j].t_);
+        CHECK(x[j + offset].fb_ == y[j].fb_);
+      }
+      auto a = stats::summarise_ant(full->colony[i], min_t, max_t);
+      auto b = stats::summarise_ant(compact->colony[i], min_t, max_t);
+      CHECK(a.nurse_share == b.nurse_share);
+      CHECK(a.num_switches == b.num_switches);
+      CHECK(a.mean_fat_body == b.mean_fat_body);
+    }
+    auto dol_full = stats::calculate_dol(full->colony, min_t, max_t);
+    auto dol_compact = stats::calculate_dol(compact->colony, min_t, max_t);
+    CHECK(dol_full.gautrais == dol_compact.gautrais);
+    CHECK(dol_full.duarte == dol_compact.duarte);
+    CHECK(dol_full.gorelick_both == dol_compact.gorelick_both);
+  }
+
+  // trajectories need the entire history
+  parameters.focal_ants = "1,2";
+  CHECK(!parameters.drop_burnin_history());
+}
+
+TEST_CASE("TEST reset simulation") {
+  params parameters;
+  parameters.simulation_time = 300;
+  parameters.colony_size = 30;
+  parameters.data_interval = 10;
+
+  for (auto scheduler : {scheduler_type::scan, scheduler_type::radix}) {
+    for (bool per_ant_rng : {false, true}) {
+      parameters.scheduler = scheduler;
+      parameters.per_ant_rng = per_ant_rng;
+      parameters.seed = 31;
+      auto reused = create_simulation(parameters);
+      reused->run();
+      size_t capacity = reused->colony[0].get_data().capacity();
+
+      parameters.seed = 32;
+      auto fresh = create_simulation(parameters);
+      fresh->run();
+      reused->reset(32);
+      CHECK(reused->colony[0].get_data().size() == 1);
+      CHECK(reused->colony[0].get_data().capacity() == capacity);
+      reused->run();
+
+      CHECK(reused->t == fresh->t);
+      REQUIRE(reused->snapshots.size() == fresh->snapshots.size());
+      for (size_t j = 0; j < fresh->snapshots.size(); ++j) {
+        CHECK(reused->snapshots[j].fb_ == fresh->snapshots[j].fb_);
+      }
+      for (size_t i = 0; i < parameters.colony_size; ++i) {
+        const auto& x = reused->colony[i].get_data();
+        const auto& y = fresh->colony[i].get_data();
+        REQUIRE(x.size() == y.size());
+        for (size_t j = 0; j < x.size(); ++j) {
+          CHECK(x[j].t_ == y[j].t_);
+          CHECK(x[j].fb_ == y[j].fb_);
+          CHECK(x[j].current_task_ == y[j].current_task_);
+        }
+        CHECK(reused->colony[i].get_num_feedings() == fresh->colony[i].get_num_feedings());
+      }
+    }
+  }
+}
+
+TEST_CASE("TEST counters") {
+  CHECK(counters::file_name("dol.txt") == "dol_counters.txt");
+  CHECK(counters::file_name("out/dol") == "out/dol_counters");
+  CHECK(counters::file_name("out.d/dol") == "out.d/dol_counters");
+
+  counters::event_counts a, b;
+  a.forage_returns = 2; a.max_nurses_at_return = 5;
+  b.forage_returns = 3; b.max_nurses_at_return = 4; b.nurse_ends = 1;
+  a.add(b);
+  CHECK(a.forage_returns == 5);
+  CHECK(a.max_nurses_at_return == 5);
+  CHECK(a.events() == 6);
+
+#ifdef DOL_COUNTERS
+  params parameters;
+  parameters.colony_size = 50;
+  parameters.simulation_time = 500;
+  parameters.seed = 3;
+  auto serial = create_simulation(parameters);
+  serial->run();
+  auto c = serial->event_counts();
+  size_t records = 0;
+  for (const auto& i : serial->colony) records += i.get_data().size();
+  CHECK(c.history_records == records);
+  CHECK(c.threshold_draws >= c.forage_returns + parameters.colony_size);
+
+  auto lane = create_simulation(parameters);
+  std::vector< Simulation* > lanes = {lane.get()};
+  BatchSimulation batch(lanes);
+  batch.run();
+  CHECK(lane->event_counts().events() == c.events());
+  CHECK(lane->event_counts().sharing_interactions == c.sharing_interactions);
+#endif
+}
+
+TEST_CASE("TEST trace") {
+  {
+    trace::scope s("not recorded");
+  }
+  trace::start();
+  {
+    trace::scope s("recorded");
+  }
+  std::thread worker([]() { trace::scope s("worker"); });
+  worker.join();
+
+  trace::write("test_trace.json");
+  std::ifstream in("test_trace.json");
+  std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  CHECK(contents.find("\"recorded\"") != std::string::npos);
+  CHECK(contents.find("\"worker\"") != std::string::npos);
+  CHECK(contents.find("not recorded") == std::string::npos);
+  std::remove("test_trace.json");
+  trace::get_registry().enabled = false;
+}
+
+TEST_CASE("TEST perf counters") {
+  perf::reading a, b;
+  a.valid[perf::cycles] = b.valid[perf::cycles] = true;
+  a.value[perf::cycles] = 100;
+  b.value[perf::cycles] = 250;
+  b.valid[perf::instructions] = true;
+  auto d = perf::difference(a, b);
+  CHECK(d.valid[perf::cycles]);
+  CHECK(d.value[perf::cycles] == 150);
+  CHECK(!d.valid[perf::instructions]);
+
+  std::ostringstream out;
+  perf::write(out, d);
+  CHECK(out.str().find("cycles=150") != std::string::npos);
+  CHECK(out.str().find("instructions=n/a") != std::string::npos);
+
+  // whatever the kernel allows, reading never fails
+  perf::phase p(true);
+  volatile double x = 0.0;
+  for (int i = 0; i < 1000; ++i) x = x + i;
+  auto r = p.stop();
+  for (size_t i = 0; i < perf::max_counter; ++i) {
+    if (r.valid[i]) CHECK(r.value[i] >= 0.0);
+  }
+}
+
+TEST_CASE("TEST progress metrics") {
+  params parameters;
+  parameters.colony_size = 20;
+  parameters.simulation_time = 200;
+  parameters.seed = 5;
+
+  progress::run_metrics metrics(1, 2, parameters.simulation_time);
+  {
+    progress::exporter exporter("test_metrics.prom", 10.0, metrics);
+    auto sim = create_simulation(parameters);
+    sim->progress_slot = &metrics.slots[0];
+    metrics.slots[0].running = true;
+    sim->run();
+    size_t records = 0;
+    for (const auto& i : sim->colony) records += i.get_data().size();
+    // every event adds one record, as do the start and the end roll call
+    CHECK(metrics.events() == records - 2 * parameters.colony_size + 1);
+    CHECK(metrics.slots[0].t == 200.0);
+    CHECK(metrics.slots[0].history_bytes == sim->history_bytes());
+    metrics.replicates_finished = 1;
+  }  // the exporter writes once more when it stops
+
+  std::ifstream in("test_metrics.prom");
+  std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  CHECK(contents.find("dol_replicates_finished 1\n") != std::string::npos);
+  CHECK(contents.find("dol_simulated_time{thread=\"0\"} 200\n") != std::string::npos);
+  CHECK(contents.find("dol_eta_seconds") != std::string::npos);
+  std::remove("test_metrics.prom");
+}
+
+TEST_CASE("TEST engine equivalence") {
+  const auto divergence = equivalence::run(equivalence::config_matrix(30, 400),
+                                           equivalence::engines(), 3);
+  INFO(divergence);
+  CHECK(divergence.empty());
+
+  // the reference engine against the checked-in histories; regenerate them
+  // with DOL_UPDATE_GOLDEN=1 after an intended change of behaviour
+  if (sizeof(time_type) == sizeof(float) && sizeof(ctype_) == sizeof(float)) {
+    const std::string golden_file = "test/golden_history.txt";
+    if (std::getenv("DOL_UPDATE_GOLDEN")) {
+      std::ofstream out(golden_file.c_str());
+      equivalence::write_golden(out, equivalence::golden_configs());
+    }
+    std::ifstream in(golden_file.c_str());
+    REQUIRE(in.is_open());
+    const auto golden = equivalence::compare_golden(in, equivalence::golden_configs(),
+                                                    equivalence::golden_tolerance());
+    INFO(golden);
+    CHECK(golden.empty());
+  }
+
+  // the harness does find a difference
+  params p;
+  p.colony_size = 30;
+  p.simulation_time = 400;
+  p.seed = 11;
+  auto a = equivalence::run_serial(p, 1);
+  p.seed = 12;
+  auto b = equivalence::run_serial(p, 1);
+  CHECK(!equivalence::compare(*a[0], *b[0], equivalence::tolerance()).empty());
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  CHECK(equivalence::close(nan, nan, 0.0));
+  CHECK(!equivalence::close(nan, 1.0, 1e9));
+  CHECK(!equivalence::close(1.0, nan, 1e9));
+}
+
+TEST_CASE("TEST cpu dispatch") {
+  const cpu::isa best = cpu::supported();
+  CHECK(cpu::select(cpu::isa::avx512) == best);
+  CHECK(cpu::select(cpu::isa::generic) == cpu::isa::generic);
+
+  params p;
+  p.colony_size = 40;
+  p.simulation_time = 300;
+  p.seed = 9;
+  p.scheduler = scheduler_type::simd;
+  p.model_type = share_model::fat_body;
+  auto reference = equivalence::run_serial(p, 1);
+  const auto dol = stats::calculate_dol(reference[0]->colony, 0, 300);
+
+  std::mt19937 rng(5);
+  std::uniform_int_distribution<int> d(0, 20);
+  next_event::simd_selector<float> selector;
+  selector.resize(500);
+  for (size_t i = 0; i < 500; ++i) selector.set(i, static_cast<float>(d(rng)));
+
+  // every level the cpu has gives the same events, statistics agree up to
+  // the order of summation
+  for (int level = 0; level <= static_cast<int>(best); ++level) {
+    INFO(cpu::name(static_cast<cpu::isa>(level)));
+    CHECK(cpu::select(static_cast<cpu::isa>(level)) == static_cast<cpu::isa>(level));
+
+    std::vector<float> v(500);
+    for (size_t i = 0; i < 500; ++i) v[i] = selector.get(i);
+    CHECK(selector.argmin() == next_event::argmin_scalar(v.data(), v.size()));
+
+    auto sim = equivalence::run_serial(p, 1);
+    CHECK(equivalence::compare(*reference[0], *sim[0], equivalence::tolerance()).empty());
+    const auto x = stats::calculate_dol(sim[0]->colony, 0, 300);
+    CHECK(x.gorelick_tasks == Approx(dol.gorelick_tasks).epsilon(1e-12));
+    CHECK(x.gorelick_indiv == Approx(dol.gorelick_indiv).epsilon(1e-12));
+    CHECK(x.gorelick_both == Approx(dol.gorelick_both).epsilon(1e-12));
+  }
+  cpu::select(cpu::isa::avx512);
+}
+
+// the histories, feedings and snapshots read through the C API are those
+// of the reference run
+void check_c_api_run(const Simulation& reference, const dol_simulation* sim) {
+  REQUIRE(dol_colony_size(sim) == reference.colony.size());
+  const dol_record* records = nullptr;
+  size_t num_records = 0;
+  for (size_t a = 0; a < reference.colony.size(); ++a) {
+    const auto& data = reference.colony[a].get_data();
+    REQUIRE(dol_history(sim, a, &records, &num_records) == DOL_OK);
+    REQUIRE(num_records == data.size());
+    for (size_t i = 0; i < num_records; ++i) {
+      CHECK(records[i].t == data[i].t_);
+      CHECK(records[i].fat_body == data[i].fb_);
+      CHECK(records[i].task == static_cast<int32_t>(data[i].current_task_));
+    }
+    uint64_t feedings = 0;
+    CHECK(dol_num_feedings(sim, a, &feedings) == DOL_OK);
+    CHECK(feedings == reference.colony[a].get_num_feedings());
+  }
+  REQUIRE(dol_snapshots(sim, &records, &num_records) == DOL_OK);
+  REQUIRE(num_records == reference.snapshots.size());
+  for (size_t i = 0; i < num_records; ++i) {
+    CHECK(records[i].t == reference.snapshots[i].t_);
+    CHECK(records[i].fat_body == reference.snapshots[i].fb_);
+  }
+}
+
+TEST_CASE("TEST c api") {
+  CHECK(dol_api_version() == DOL_API_VERSION);
+  CHECK(dol_time_size() == sizeof(time_type));
+
+  dol_params d;
+  dol_default_params(&d);
+  d.colony_size = 30;
+  d.simulation_time = 300;
+  d.data_interval = 10;
+  d.seed = 4;
+
+  params p;
+  p.colony_size = 30;
+  p.simulation_time = 300;
+  p.data_interval = 10;
+  p.seed = 4;
+  auto reference = create_simulation(p);
+  reference->run();
+
+  // stepped, run until a time and run to the end: as one run
+  dol_simulation* sim = dol_create(&d);
+  REQUIRE(sim != nullptr);
+  CHECK(dol_step(sim, 100) == DOL_OK);
+  CHECK(dol_run_until(sim, 150.0) == DOL_OK);
+  CHECK(dol_time(sim) == 150.0);
+  CHECK(dol_next_event_time(sim) >= 150.0);
+  CHECK(!dol_finished(sim));
+  CHECK(dol_run(sim) == DOL_OK);
+  CHECK(dol_finished(sim));
+  check_c_api_run(*reference, sim);
+
+  // histories point into the simulation, they are not copied
+  const dol_record* records = nullptr;
+  const dol_record* again = nullptr;
+  size_t num_records = 0;
+  CHECK(dol_history(sim, 7, &records, &num_records) == DOL_OK);
+  CHECK(dol_history(sim, 7, &again, &num_records) == DOL_OK);
+  CHECK(records == again);
+
+  dol_metrics m;
+  CHECK(dol_calculate_dol(sim, 30.0, 300.0, &m) == DOL_OK);
+  const auto dol = stats::calculate_dol(reference->colony, 30, 300);
+  CHECK(m.gautrais == dol.gautrais);
+  CHECK(m.gorelick_both == dol.gorelick_both);
+
+  // errors are returned, not thrown
+  CHECK(dol_step(sim, 1) == DOL_ERROR);
+  CHECK(std::string(dol_last_error()).find("finished") != std::string::npos);
+  CHECK(dol_history(sim, 30, &records, &num_records) == DOL_ERROR);
+
+  // a reset replicate in the same memory
+  CHECK(dol_reset(sim, 4) == DOL_OK);
+  CHECK(dol_run(sim) == DOL_OK);
+  check_c_api_run(*reference, sim);
+  dol_destroy(sim);
+
+  d.model_type = 7;
+  CHECK(dol_create(&d) == nullptr);
+  CHECK(std::string(dol_last_error()).find("model_type") != std::string::npos);
+}
+
+TEST_CASE("TEST observer") {
+  params p;
+  p.colony_size = 30;
+  p.simulation_time = 300;
+  p.data_interval = 10;
+  p.seed = 17;
+
+  for (auto threads : {1, 3}) {
+    p.num_colony_threads = threads;
+    p.per_ant_rng = threads > 1;
+    auto reference = create_simulation(p);
+    reference->run();
+
+    // observing between run_until calls does not change the run
+    auto sim = create_simulation(p);
+    colony_observer colony(*sim);
+    std::vector<ctype_> fat_bodies;
+    for (time_type t = 50; t < 300; t += 50) {
+      sim->run_until(t);
+      CHECK(colony.time() == t);
+      CHECK(sim->snapshots.size() == p.colony_size * static_cast<size_t>(t / 10));
+
+      const auto counts = colony.task_counts();
+      CHECK(counts[0] + counts[1] + counts[2] == p.colony_size);
+      colony.fat_bodies(fat_bodies);
+      REQUIRE(fat_bodies.size() == p.colony_size);
+      for (size_t i = 0; i < p.colony_size; ++i) {
+        const auto a = colony.ant(i);
+        CHECK(a.fat_body == fat_bodies[i]);
+        CHECK(a.next_t >= t);
+        CHECK(a.num_records == colony.history(i).size());
+        CHECK(&colony.history(i) == &sim->colony[i].get_data());
+      }
+    }
+    sim->run();
+    CHECK(equivalence::compare(*reference, *sim, equivalence::tolerance()).empty());
+  }
+
+  // fat bodies are those of a roll call at the time of the observer
+  p.num_colony_threads = 1;
+  p.per_ant_rng = false;
+  auto sim = create_simulation(p);
+  sim->run_until(150);
+  std::vector<ctype_> fat_bodies;
+  colony_observer(*sim).fat_bodies(fat_bodies);
+  for (size_t i = 0; i < p.colony_size; ++i) {
+    sim->colony[i].update_fatbody(150);
+    CHECK(sim->colony[i].get_fat_body() == fat_bodies[i]);
+  }
+
+  // the same through the C API
+  dol_params d;
+  dol_default_params(&d);
+  d.colony_size = 30;
+  d.simulation_time = 300;
+  d.seed = 17;
+  dol_simulation* c = dol_create(&d);
+  REQUIRE(c != nullptr);
+  CHECK(dol_run_until(c, 150.0) == DOL_OK);
+  CHECK(dol_time(c) == 150.0);
+  uint64_t counts[3];
+  CHECK(dol_task_counts(c, counts) == DOL_OK);
+  CHECK(counts[0] + counts[1] + counts[2] == 30);
+  std::vector<dol_state_t> fb(30);
+  CHECK(dol_fat_bodies(c, fb.data(), fb.size()) == DOL_OK);
+  CHECK(dol_fat_bodies(c, fb.data(), 10) == DOL_ERROR);
+  dol_ant_state a;
+  CHECK(dol_ant(c, 5, &a) == DOL_OK);
+  CHECK(a.fat_body == fb[5]);
+  CHECK(a.fat_body == fat_bodies[5]);
+  CHECK(dol_ant(c, 30, &a) == DOL_ERROR);
+  dol_destroy(c);
+}
@@ -0,0 +1,137 @@
+//
+//  trace.h
+//  dol_fatbody_tj
+//
+//  Scoped timers written as Chrome trace events (chrome://tracing, or
+//  ui.perfetto.dev), switched on with trace_file= in the config. Every
+//  thread records into its own buffer, so recording takes no locks; a
+//  mutex is only taken when a thread records its first event. When
+//  tracing is off, a scope costs one relaxed atomic load.
+//
+
+#ifndef trace_h
+#define trace_h
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace trace {
+
+  using clock = std::chrono::steady_clock;
+
+  struct event {
+    const char* name;   // string literal
+    clock::time_point start;
+    clock::time_point end;
+  };
+
+  struct thread_buffer {
+    size_t tid;
+    std::vector<event> events;
+  };
+
+  // buffers of all threads that have recorded events. Buffers are owned
+  // here rather than by the threads, so that they outlive them.
+  struct registry {
+    std::atomic<bool> enabled{false};
+    std::mutex mutex;
+    std::vector< std::unique_ptr<thread_buffer> > buffers;
+  };
+
+  inline registry& get_registry() {
+    static registry r;
+    return r;
+  }
+
+  inline bool enabled() {
+    return get_registry().enabled.load(std::memory_order_relaxed);
+  }
+
+  inline void start() {
+    get_registry().enabled.store(true, std::memory_order_relaxed);
+  }
+
+  inline thread_buffer& local_buffer() {
+    thread_local thread_buffer* buffer = nullptr;
+    if (!buffer) {
+      auto& r = get_registry();
+      std::lock_guard<std::mutex> lock(r.mutex);
+      r.buffers.push_back(std::make_unique<thread_buffer>());
+      buffer = r.buffers.back().get();
+      buffer->tid = r.buffers.size();
+    }
+    return *buffer;
+  }
+
+  // records an event that has already ended, for spans that start before
+  // tracing can be switched on
+  inline void record(const char* name, clock::time_point start, clock::time_point end) {
+    if (!enabled()) return;
+    local_buffer().events.push_back({name, start, end});
+  }
+
+  // times its own lifetime
+  class scope {
+  public:
+    explicit scope(const char* name) : name_(name), active_(enabled()) {
+      if (active_) start_ = clock::now();
+    }
+
+    ~scope() {
+      if (active_) local_buffer().events.push_back({name_, start_, clock::now()});
+    }
+
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+  private:
+    const char* name_;
+    bool active_;
+    clock::time_point start_;
+  };
+
+  // trace event JSON of all events recorded so far. Only call this when
+  // no other thread records events, e.g. after all workers have joined.
+  inline void write(const std::string& file_name) {
+    std::ofstream out(file_name.c_str());
+    if (!out.is_open()) throw std::runtime_error("can't open trace file: " + file_name);
+
+    auto& r = get_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    // times are relative to the first event
+    auto origin = clock::time_point::max();
+    for (const auto& b : r.buffers) {
+      for (const auto& e : b->events) origin = std::min(origin, e.start);
+    }
+    auto us = [&](clock::time_point t) {
+      return std::chrono::duration<double, std::micro>(t - origin).count();
+    };
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (const auto& b : r.buffers) {
+      out << (first ? "" : ",\n")
+          << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << b->tid
+          << ", \"args\": {\"name\": \"thread " << b->tid << "\"}}";
+      first = false;
+      for (const auto& e : b->events) {
+        out << ",\n{\"name\": \"" << e.name << "\", \"cat\": \"dol\", \"ph\": \"X\", "
+            << "\"ts\": " << us(e.start) << ", \"dur\": " << us(e.end) - us(e.start)
+            << ", \"pid\": 1, \"tid\": " << b->tid << "}";
+      }
+    }
+    out << "\n]}\n";
+    out.flush();
+    if (!out) throw std::runtime_error("failed writing to: " + file_name);
+  }
+}
+
+#endif /* trace_h */
@@ -0,0 +1,104 @@
+//
+//  worker_pool.h
+//  dol_fatbody_tj
+//
+
+#ifndef worker_pool_h
+#define worker_pool_h
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that repeatedly execute a batch of chunks.
+// run() hands out chunk indices [0, num_chunks) to the workers and to the
+// calling thread, and returns once all chunks are done. Threads are
+// created once, so that a batch costs a wake-up rather than a thread start.
+class worker_pool {
+public:
+  explicit worker_pool(size_t num_threads) {
+    // the calling thread also works, so we need one thread less
+    for (size_t i = 1; i < num_threads; ++i) {
+      workers_.emplace_back([this]() { work(); });
+    }
+  }
+
+  worker_pool(const worker_pool&) = delete;
+  worker_pool& operator=(const worker_pool&) = delete;
+
+  ~worker_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+      generation_++;
+    }
+    start_.notify_all();
+    for (auto& i : workers_) i.join();
+  }
+
+  size_t num_threads() const {return workers_.size() + 1;}
+
+  void run(size_t num_chunks, const std::function<void(size_t)>& f) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      task_ = &f;
+      num_chunks_ = num_chunks;
+      next_chunk_ = 0;
+      busy_ = workers_.size();
+      generation_++;
+    }
+    start_.notify_all();
+
+    do_chunks(f, num_chunks);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return busy_ == 0; });
+    task_ = nullptr;
+  }
+
+private:
+  void do_chunks(const std::function<void(size_t)>& f, size_t num_chunks) {
+    while (true) {
+      size_t chunk = next_chunk_++;
+      if (chunk >= num_chunks) return;
+      f(chunk);
+    }
+  }
+
+  void work() {
+    size_t seen_generation = 0;
+    while (true) {
+      const std::function<void(size_t)>* f;
+      size_t num_chunks;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_.wait(lock, [&]() { return generation_ != seen_generation; });
+        seen_generation = generation_;
+        if (stop_) return;
+        f = task_;
+        num_chunks = num_chunks_;
+      }
+
+      do_chunks(*f, num_chunks);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--busy_ == 0) done_.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  const std::function<void(size_t)>* task_ = nullptr;
+  size_t num_chunks_ = 0;
+  std::atomic<size_t> next_chunk_{0};
+  size_t busy_ = 0;
+  size_t generation_ = 0;
+  bool stop_ = false;
+};
+
+#endif /* worker_pool_h */